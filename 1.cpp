@@ -1,141 +1,715 @@
 #include <iostream>
 #include <stdexcept>
 #include <cstring>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <utility>
 #include <string>
+#include <chrono>
+#include <memory>
+#include <cstddef>
+#include <iterator>
+#include <algorithm>
+#include <numeric>
+#include <deque>
+#include <vector>
+#include <random>
+#include <memory_resource>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include "replay.h"
+#include "bench.h"
 
+// Default block geometry: roughly 4 KiB per block, but never fewer than
+// 16 elements so that large element types still amortize the map.
 template<typename T>
+struct DequeBlockTraits {
+    static const int TARGET_BYTES = 4096;
+    static const int MIN_ELEMENTS = 16;
+    static const int size = sizeof(T) * MIN_ELEMENTS >= TARGET_BYTES ? MIN_ELEMENTS
+                                                                     : static_cast<int>(TARGET_BYTES / sizeof(T));
+};
+
+// Allocator is rebound for both the map (T*) and the element blocks, so a
+// std::pmr::polymorphic_allocator routes every allocation to its resource.
+// Elements themselves are placement-constructed, not via the allocator.
+template<typename T, int BlockSize = DequeBlockTraits<T>::size, typename Allocator = std::allocator<T>>
 class Deque {
 private:
-    static const int BLOCK_SIZE = 64;
+    static_assert(BlockSize >= 2, "Deque blocks need room on both sides of the center");
+
+    static const int BLOCK_SIZE = BlockSize;
+    static const int DEFAULT_SPARE_BLOCKS = 2;
+    static constexpr std::size_t BLOCK_ALIGNMENT = alignof(T) > 64 ? alignof(T) : 64;
+
+    struct alignas(BLOCK_ALIGNMENT) BlockUnit {
+        unsigned char bytes[BLOCK_ALIGNMENT];
+    };
+    static constexpr std::size_t BLOCK_UNITS = (sizeof(T) * BLOCK_SIZE + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT;
 
+    using AllocTraits = std::allocator_traits<Allocator>;
+    using BlockTraits = typename AllocTraits::template rebind_traits<BlockUnit>;
+    using BlockAllocator = typename BlockTraits::allocator_type;
+    using MapTraits = typename AllocTraits::template rebind_traits<T*>;
+    using MapAllocator = typename MapTraits::allocator_type;
+
+    Allocator alloc;
+
+    // Blocks are raw, uninitialized storage; only the slots between
+    // (startBlock, startOffset) and (endBlock, endOffset) hold live objects.
     T** map;
     int mapSize;
     int startBlock, startOffset;
     int endBlock, endOffset;
     int count;
 
-    void reallocateMap(int newMapSize) {
-        int newCenter = newMapSize / 2;
-        T** newMap = new T*[newMapSize];
-        std::memset(newMap, 0, sizeof(T*) * newMapSize);
+    // Blocks released by pop_* are parked here instead of being freed, so
+    // push/pop oscillating around a block boundary does no heap traffic.
+    T** spareBlocks;
+    int spareCount;
+    int spareLimit;
 
-        int offset = newCenter - (endBlock - startBlock) / 2;
-        for (int i = startBlock; i <= endBlock; ++i) {
-            newMap[offset + (i - startBlock)] = map[i];
+    // Blocks start on a cache-line boundary so a block never shares its
+    // first line with unrelated heap data.
+    T* allocateBlock() {
+        BlockAllocator a(alloc);
+        return reinterpret_cast<T*>(BlockTraits::allocate(a, BLOCK_UNITS));
+    }
+
+    void freeBlock(T* block) {
+        BlockAllocator a(alloc);
+        BlockTraits::deallocate(a, reinterpret_cast<BlockUnit*>(block), BLOCK_UNITS);
+    }
+
+    T** allocateMap(int size) {
+        if (size == 0) return nullptr;
+        MapAllocator a(alloc);
+        T** m = MapTraits::allocate(a, size);
+        std::memset(m, 0, sizeof(T*) * size);
+        return m;
+    }
+
+    void freeMap(T** m, int size) {
+        if (!m) return;
+        MapAllocator a(alloc);
+        MapTraits::deallocate(a, m, size);
+    }
+
+    // Places the live blocks in a map of newMapSize slots, centered in the
+    // space left after reserving frontBlocks/backBlocks free slots. With an
+    // unchanged size the blocks are shifted in place.
+    void reallocateMap(int newMapSize, int frontBlocks = 0, int backBlocks = 0) {
+        int used = endBlock - startBlock + 1;
+        int newStart = frontBlocks + (newMapSize - used - frontBlocks - backBlocks) / 2;
+
+        if (newMapSize == mapSize) {
+            std::memmove(map + newStart, map + startBlock, sizeof(T*) * used);
+            if (newStart > startBlock) {
+                std::fill(map + startBlock, map + std::min(newStart, endBlock + 1), nullptr);
+            } else {
+                std::fill(map + std::max(newStart + used, startBlock), map + endBlock + 1, nullptr);
+            }
+        } else {
+            T** newMap = allocateMap(newMapSize);
+            std::memcpy(newMap + newStart, map + startBlock, sizeof(T*) * used);
+            freeMap(map, mapSize);
+            map = newMap;
+            mapSize = newMapSize;
+        }
+        startBlock = newStart;
+        endBlock = newStart + used - 1;
+    }
+
+    // Makes room for extra blocks on either side of the live ones. A map that
+    // would be at most half full is recentered rather than doubled, so a FIFO
+    // drifting towards one end keeps reusing the same map.
+    void reserveMapBlocks(int frontBlocks, int backBlocks) {
+        if (!map) allocateEmptyLayout();
+        if (startBlock >= frontBlocks && endBlock + backBlocks < mapSize) return;
+
+        int needed = endBlock - startBlock + 1 + frontBlocks + backBlocks;
+        int newMapSize = mapSize;
+        while (needed * 2 > newMapSize) {
+            newMapSize *= 2;
+        }
+        reallocateMap(newMapSize, frontBlocks, backBlocks);
+    }
+
+    T* acquireBlock() {
+        if (spareCount > 0) {
+            return spareBlocks[--spareCount];
+        }
+        return allocateBlock();
+    }
+
+    void releaseBlock(T* block) {
+        if (spareCount < spareLimit) {
+            spareBlocks[spareCount++] = block;
+        } else {
+            freeBlock(block);
         }
+    }
 
-        delete[] map;
-        map = newMap;
-        endBlock = offset + (endBlock - startBlock);
-        startBlock = offset;
-        mapSize = newMapSize;
+    void releaseSpareBlocks() {
+        while (spareCount > 0) {
+            freeBlock(spareBlocks[--spareCount]);
+        }
     }
 
     void ensureFrontCapacity() {
+        if (!map) allocateEmptyLayout();
         if (startOffset == 0) {
             if (startBlock == 0) {
-                reallocateMap(mapSize * 2);
+                reserveMapBlocks(1, 0);
             }
-            map[--startBlock] = new T[BLOCK_SIZE];
+            map[--startBlock] = acquireBlock();
             startOffset = BLOCK_SIZE;
         }
     }
 
     void ensureBackCapacity() {
+        if (!map) allocateEmptyLayout();
         if (endOffset == BLOCK_SIZE) {
             if (endBlock == mapSize - 1) {
-                reallocateMap(mapSize * 2);
+                reserveMapBlocks(0, 1);
             }
-            map[++endBlock] = new T[BLOCK_SIZE];
+            map[++endBlock] = acquireBlock();
             endOffset = 0;
         }
     }
 
+    // Undo an ensure*Capacity whose fresh block never received its element.
+    void dropEmptyFrontBlock() {
+        if (startOffset == BLOCK_SIZE && startBlock < endBlock) {
+            releaseBlock(map[startBlock]);
+            map[startBlock++] = nullptr;
+            startOffset = 0;
+        }
+    }
+
+    void dropEmptyBackBlock() {
+        if (endOffset == 0 && endBlock > startBlock) {
+            releaseBlock(map[endBlock]);
+            map[endBlock--] = nullptr;
+            endOffset = BLOCK_SIZE;
+        }
+    }
+
+    // Adjusts the map at most once so that n more elements fit at the back.
+    // Also gives a deque without a map its first block.
+    void reserveMapBack(int n) {
+        int spill = n - (BLOCK_SIZE - endOffset);
+        reserveMapBlocks(0, spill > 0 ? (spill + BLOCK_SIZE - 1) / BLOCK_SIZE : 0);
+    }
+
+    void reserveMapFront(int n) {
+        int spill = n - startOffset;
+        reserveMapBlocks(spill > 0 ? (spill + BLOCK_SIZE - 1) / BLOCK_SIZE : 0, 0);
+    }
+
+    // Copies n elements into raw storage; plain memcpy when T allows it.
+    template<typename It>
+    static It constructRange(It first, int n, T* dest) {
+        if constexpr (std::is_trivially_copyable<T>::value && std::is_pointer<It>::value &&
+                      std::is_same<typename std::remove_cv<typename std::remove_pointer<It>::type>::type, T>::value) {
+            std::memcpy(static_cast<void*>(dest), first, sizeof(T) * n);
+            return first + n;
+        } else {
+            It last = std::next(first, n);
+            std::uninitialized_copy(first, last, dest);
+            return last;
+        }
+    }
+
+    // Appends n elements a block at a time; fill(dest, k) constructs k of them.
+    template<typename Fill>
+    void fillBack(int n, Fill fill) {
+        if (n <= 0) return;
+        if (count == 0) {
+            startOffset = endOffset = 0;
+        }
+        reserveMapBack(n);
+        while (n > 0) {
+            ensureBackCapacity();
+            int chunk = std::min(n, BLOCK_SIZE - endOffset);
+            try {
+                fill(map[endBlock] + endOffset, chunk);
+            } catch (...) {
+                dropEmptyBackBlock();
+                if (count == 0) startOffset = endOffset = BLOCK_SIZE / 2;
+                throw;
+            }
+            endOffset += chunk;
+            count += chunk;
+            n -= chunk;
+        }
+    }
+
+    T* slot(int index) const {
+        int pos = startOffset + index;
+        return map[startBlock + pos / BLOCK_SIZE] + pos % BLOCK_SIZE;
+    }
+
+    void destroyElements() {
+        if constexpr (!std::is_trivially_destructible<T>::value) {
+            for (int i = 0; i < count; ++i) {
+                slot(i)->~T();
+            }
+        }
+        count = 0;
+    }
+
     void cleanup() {
+        destroyElements();
         for (int i = startBlock; i <= endBlock; ++i) {
-            delete[] map[i];
+            freeBlock(map[i]);
         }
-        delete[] map;
+        freeMap(map, mapSize);
     }
 
-public:
-    Deque()
-        : mapSize(8), startBlock(4), endBlock(4), startOffset(BLOCK_SIZE / 2), endOffset(BLOCK_SIZE / 2), count(0) {
-        map = new T*[mapSize];
-        std::memset(map, 0, sizeof(T*) * mapSize);
-        map[startBlock] = new T[BLOCK_SIZE];
+
+    // A moved-from deque has no map and no blocks; the first operation that
+    // needs storage allocates it here. The offsets are left as they are.
+    void allocateEmptyLayout() {
+        T** m = allocateMap(8);
+        try {
+            m[4] = acquireBlock();
+        } catch (...) {
+            freeMap(m, 8);
+            throw;
+        }
+        map = m;
+        mapSize = 8;
+        startBlock = endBlock = 4;
     }
 
-    Deque(const Deque& other)
-        : mapSize(other.mapSize), startBlock(other.startBlock), endBlock(other.endBlock),
-          startOffset(other.startOffset), endOffset(other.endOffset), count(other.count) {
-        map = new T*[mapSize];
-        for (int i = 0; i < mapSize; ++i) {
-            if (other.map[i]) {
-                map[i] = new T[BLOCK_SIZE];
-                std::copy(other.map[i], other.map[i] + BLOCK_SIZE, map[i]);
+    // The state a move leaves behind: empty, owning nothing.
+    void dropLayout() {
+        map = nullptr;
+        mapSize = 0;
+        startBlock = 0;
+        endBlock = -1;
+        startOffset = endOffset = BLOCK_SIZE / 2;
+        count = 0;
+    }
+
+    // Lays out a fresh map sized for other's live blocks, not its map. A
+    // moved-from other still gets one block here.
+    // If an allocation fails, nothing is kept and the deque is unchanged.
+    void allocateLayoutLike(const Deque& other) {
+        int used = std::max(1, other.endBlock - other.startBlock + 1);
+        int size = 8;
+        while (size < used * 2) {
+            size *= 2;
+        }
+        T** m = allocateMap(size);
+        int first = (size - used) / 2;
+        int i = first;
+        try {
+            for (; i < first + used; ++i) {
+                m[i] = allocateBlock();
+            }
+        } catch (...) {
+            while (i-- > first) {
+                freeBlock(m[i]);
+            }
+            freeMap(m, size);
+            throw;
+        }
+        map = m;
+        mapSize = size;
+        startBlock = first;
+        endBlock = first + used - 1;
+    }
+
+    // Copies other's live slots block by block into an equally long run of
+    // blocks starting at startBlock; dead slots are never touched.
+    void copyBlocksFrom(const Deque& other) {
+        startOffset = other.startOffset;
+        endOffset = other.endOffset;
+        count = 0;
+        for (int i = 0; i <= other.endBlock - other.startBlock; ++i) {
+            int lo = i == 0 ? other.startOffset : 0;
+            int hi = other.startBlock + i == other.endBlock ? other.endOffset : BLOCK_SIZE;
+            constructRange(other.map[other.startBlock + i] + lo, hi - lo, map[startBlock + i] + lo);
+            count += hi - lo;
+        }
+    }
+
+public:
+    // Iterators address elements as (map slot, offset) and only read the map
+    // slot when dereferenced, so end() is valid even past the last block.
+    template<typename V>
+    class Iterator {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = typename std::remove_const<V>::type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = V*;
+        using reference = V&;
+
+        Iterator() : node(nullptr), offset(0) {}
+
+        template<typename W, typename = typename std::enable_if<std::is_const<V>::value && !std::is_const<W>::value>::type>
+        Iterator(const Iterator<W>& other) : node(other.node), offset(other.offset) {}
+
+        reference operator*() const { return (*node)[offset]; }
+        pointer operator->() const { return *node + offset; }
+        reference operator[](difference_type n) const { return *(*this + n); }
+
+        Iterator& operator++() {
+            if (++offset == BLOCK_SIZE) {
+                ++node;
+                offset = 0;
+            }
+            return *this;
+        }
+
+        Iterator& operator--() {
+            if (offset-- == 0) {
+                --node;
+                offset = BLOCK_SIZE - 1;
+            }
+            return *this;
+        }
+
+        Iterator operator++(int) { Iterator tmp = *this; ++*this; return tmp; }
+        Iterator operator--(int) { Iterator tmp = *this; --*this; return tmp; }
+
+        Iterator& operator+=(difference_type n) {
+            difference_type pos = offset + n;
+            if (pos >= 0) {
+                node += pos / BLOCK_SIZE;
+                offset = static_cast<int>(pos % BLOCK_SIZE);
             } else {
-                map[i] = nullptr;
+                difference_type blocks = (-pos - 1) / BLOCK_SIZE + 1;
+                node -= blocks;
+                offset = static_cast<int>(pos + blocks * BLOCK_SIZE);
             }
+            return *this;
+        }
+
+        Iterator& operator-=(difference_type n) { return *this += -n; }
+
+        friend Iterator operator+(Iterator it, difference_type n) { return it += n; }
+        friend Iterator operator+(difference_type n, Iterator it) { return it += n; }
+        friend Iterator operator-(Iterator it, difference_type n) { return it -= n; }
+
+        friend difference_type operator-(const Iterator& a, const Iterator& b) {
+            return (a.node - b.node) * BLOCK_SIZE + (a.offset - b.offset);
+        }
+
+        friend bool operator==(const Iterator& a, const Iterator& b) { return a.node == b.node && a.offset == b.offset; }
+        friend bool operator!=(const Iterator& a, const Iterator& b) { return !(a == b); }
+        friend bool operator<(const Iterator& a, const Iterator& b) {
+            return a.node < b.node || (a.node == b.node && a.offset < b.offset);
+        }
+        friend bool operator>(const Iterator& a, const Iterator& b) { return b < a; }
+        friend bool operator<=(const Iterator& a, const Iterator& b) { return !(b < a); }
+        friend bool operator>=(const Iterator& a, const Iterator& b) { return !(a < b); }
+
+    private:
+        template<typename> friend class Iterator;
+        friend class Deque;
+
+        Iterator(T* const* node, int offset) : node(node), offset(offset) {}
+
+        T* const* node;
+        int offset;
+    };
+
+    using iterator = Iterator<T>;
+    using const_iterator = Iterator<const T>;
+
+    explicit Deque(int spareBlockLimit = DEFAULT_SPARE_BLOCKS, const Allocator& allocator = Allocator())
+        : alloc(allocator), mapSize(8), startBlock(4), endBlock(4), startOffset(BLOCK_SIZE / 2), endOffset(BLOCK_SIZE / 2),
+          count(0), spareCount(0), spareLimit(spareBlockLimit < 0 ? 0 : spareBlockLimit) {
+        map = allocateMap(mapSize);
+        map[startBlock] = allocateBlock();
+        spareBlocks = allocateMap(spareLimit);
+    }
+
+    explicit Deque(const Allocator& allocator)
+        : Deque(DEFAULT_SPARE_BLOCKS, allocator) {}
+
+    // A throwing element copy destroys the elements copied so far and frees
+    // everything allocated, since no destructor runs for this deque.
+    Deque(const Deque& other)
+        : alloc(AllocTraits::select_on_container_copy_construction(other.alloc)),
+          map(nullptr), mapSize(0), startBlock(0), startOffset(BLOCK_SIZE / 2), endBlock(-1), endOffset(BLOCK_SIZE / 2),
+          count(0), spareBlocks(nullptr), spareCount(0), spareLimit(other.spareLimit) {
+        spareBlocks = allocateMap(spareLimit);
+        try {
+            allocateLayoutLike(other);
+            copyBlocksFrom(other);
+        } catch (...) {
+            cleanup();
+            freeMap(spareBlocks, spareLimit);
+            throw;
         }
     }
 
+    // Steals other's map and blocks. other is left empty without a map and
+    // allocates one again on its next push.
+    Deque(Deque&& other) noexcept
+        : alloc(std::move(other.alloc)), map(other.map), mapSize(other.mapSize),
+          startBlock(other.startBlock), startOffset(other.startOffset),
+          endBlock(other.endBlock), endOffset(other.endOffset), count(other.count),
+          spareBlocks(other.spareBlocks), spareCount(other.spareCount), spareLimit(other.spareLimit) {
+        other.dropLayout();
+        other.spareBlocks = nullptr;
+        other.spareCount = 0;
+        other.spareLimit = 0;
+    }
+
+    // Keeps the blocks this deque already owns and only acquires or releases
+    // the difference in block count.
     Deque& operator=(const Deque& other) {
         if (this == &other) return *this;
 
+        if constexpr (AllocTraits::propagate_on_container_copy_assignment::value) {
+            if (alloc != other.alloc) {
+                cleanup();
+                releaseSpareBlocks();
+                freeMap(spareBlocks, spareLimit);
+                alloc = other.alloc;
+                spareBlocks = allocateMap(spareLimit);
+                allocateLayoutLike(other);
+                copyBlocksFrom(other);
+                return *this;
+            }
+            alloc = other.alloc;
+        }
+        if (!map) {
+            allocateLayoutLike(other);
+            copyBlocksFrom(other);
+            return *this;
+        }
+
+        destroyElements();
+        int used = std::max(1, other.endBlock - other.startBlock + 1);
+        while (endBlock - startBlock + 1 > used) {
+            releaseBlock(map[endBlock]);
+            map[endBlock--] = nullptr;
+        }
+        int missing = used - (endBlock - startBlock + 1);
+        if (missing > 0) {
+            reserveMapBlocks(0, missing);
+            while (missing-- > 0) {
+                map[++endBlock] = acquireBlock();
+            }
+        }
+        try {
+            copyBlocksFrom(other);
+        } catch (...) {
+            clear();
+            throw;
+        }
+
+        return *this;
+    }
+
+    Deque& operator=(Deque&& other) noexcept(AllocTraits::propagate_on_container_move_assignment::value ||
+                                              AllocTraits::is_always_equal::value) {
+        if (this == &other) return *this;
+
+        if constexpr (!AllocTraits::propagate_on_container_move_assignment::value) {
+            // Storage from a different arena cannot be adopted; move element-wise.
+            if (alloc != other.alloc) {
+                clear();
+                append(std::make_move_iterator(other.begin()), std::make_move_iterator(other.end()));
+                other.clear();
+                return *this;
+            }
+        }
+
         cleanup();
+        releaseSpareBlocks();
+        freeMap(spareBlocks, spareLimit);
+
+        if constexpr (AllocTraits::propagate_on_container_move_assignment::value) {
+            alloc = std::move(other.alloc);
+        }
+        map = other.map;
         mapSize = other.mapSize;
         startBlock = other.startBlock;
         endBlock = other.endBlock;
         startOffset = other.startOffset;
         endOffset = other.endOffset;
         count = other.count;
+        spareBlocks = other.spareBlocks;
+        spareCount = other.spareCount;
+        spareLimit = other.spareLimit;
 
-        map = new T*[mapSize];
-        for (int i = 0; i < mapSize; ++i) {
-            if (other.map[i]) {
-                map[i] = new T[BLOCK_SIZE];
-                std::copy(other.map[i], other.map[i] + BLOCK_SIZE, map[i]);
-            } else {
-                map[i] = nullptr;
-            }
-        }
+        other.dropLayout();
+        other.spareBlocks = nullptr;
+        other.spareCount = 0;
+        other.spareLimit = 0;
 
         return *this;
     }
 
     ~Deque() {
         cleanup();
+        releaseSpareBlocks();
+        freeMap(spareBlocks, spareLimit);
     }
 
-    void push_back(const T& value) {
+    Allocator get_allocator() const {
+        return alloc;
+    }
+
+    template<typename... Args>
+    T& emplace_back(Args&&... args) {
         ensureBackCapacity();
-        map[endBlock][endOffset++] = value;
+        T* p = map[endBlock] + endOffset;
+        try {
+            ::new (static_cast<void*>(p)) T(std::forward<Args>(args)...);
+        } catch (...) {
+            dropEmptyBackBlock();
+            throw;
+        }
+        endOffset++;
         count++;
+        return *p;
     }
 
-    void push_front(const T& value) {
+    template<typename... Args>
+    T& emplace_front(Args&&... args) {
         ensureFrontCapacity();
-        map[startBlock][--startOffset] = value;
+        T* p = map[startBlock] + startOffset - 1;
+        try {
+            ::new (static_cast<void*>(p)) T(std::forward<Args>(args)...);
+        } catch (...) {
+            dropEmptyFrontBlock();
+            throw;
+        }
+        startOffset--;
         count++;
+        return *p;
+    }
+
+    void push_back(const T& value) {
+        emplace_back(value);
+    }
+
+    void push_back(T&& value) {
+        emplace_back(std::move(value));
     }
 
+    void push_front(const T& value) {
+        emplace_front(value);
+    }
+
+    void push_front(T&& value) {
+        emplace_front(std::move(value));
+    }
+
+    template<typename InputIt>
+    void append(InputIt first, InputIt last) {
+        using Category = typename std::iterator_traits<InputIt>::iterator_category;
+        if constexpr (!std::is_base_of<std::forward_iterator_tag, Category>::value) {
+            for (; first != last; ++first) {
+                emplace_back(*first);
+            }
+        } else {
+            fillBack(static_cast<int>(std::distance(first, last)), [&first](T* dest, int k) {
+                first = constructRange(first, k, dest);
+            });
+        }
+    }
+
+    // Inserts [first, last) in front of the current elements, keeping its order.
+    template<typename InputIt>
+    void prepend(InputIt first, InputIt last) {
+        using Category = typename std::iterator_traits<InputIt>::iterator_category;
+        if constexpr (!std::is_base_of<std::forward_iterator_tag, Category>::value) {
+            std::vector<T> items(first, last);
+            prepend(std::make_move_iterator(items.begin()), std::make_move_iterator(items.end()));
+        } else {
+            int n = static_cast<int>(std::distance(first, last));
+            if (n == 0) return;
+            reserveMapFront(n);
+
+            int pos = startOffset - n;
+            int newBlocks = pos < 0 ? (-pos + BLOCK_SIZE - 1) / BLOCK_SIZE : 0;
+            int newStartBlock = startBlock - newBlocks;
+            int newStartOffset = pos + newBlocks * BLOCK_SIZE;
+            for (int i = newStartBlock; i < startBlock; ++i) {
+                map[i] = acquireBlock();
+            }
+
+            int block = newStartBlock, offset = newStartOffset, done = 0;
+            try {
+                while (done < n) {
+                    int chunk = std::min(n - done, BLOCK_SIZE - offset);
+                    first = constructRange(first, chunk, map[block] + offset);
+                    done += chunk;
+                    block++;
+                    offset = 0;
+                }
+            } catch (...) {
+                if constexpr (!std::is_trivially_destructible<T>::value) {
+                    for (int i = 0; i < done; ++i) {
+                        int p = newStartOffset + i;
+                        map[newStartBlock + p / BLOCK_SIZE][p % BLOCK_SIZE].~T();
+                    }
+                }
+                for (int i = newStartBlock; i < startBlock; ++i) {
+                    releaseBlock(map[i]);
+                    map[i] = nullptr;
+                }
+                throw;
+            }
+
+            startBlock = newStartBlock;
+            startOffset = newStartOffset;
+            count += n;
+        }
+    }
+
+    void assign(int n, const T& value) {
+        clear();
+        fillBack(n, [&value](T* dest, int k) {
+            std::uninitialized_fill_n(dest, k, value);
+        });
+    }
+
+    void clear() {
+        destroyElements();
+        if (!map) return;
+        for (int i = startBlock + 1; i <= endBlock; ++i) {
+            releaseBlock(map[i]);
+            map[i] = nullptr;
+        }
+        endBlock = startBlock;
+        startOffset = endOffset = BLOCK_SIZE / 2;
+    }
+
+    // A block is handed back as soon as it holds no live element, so the
+    // back block always has 1..BLOCK_SIZE elements and back() stays valid.
     void pop_back() {
         if (count == 0) throw std::underflow_error("Deque is empty");
-        if (--endOffset < 0) {
-            delete[] map[endBlock--];
-            endOffset = BLOCK_SIZE - 1;
+        map[endBlock][endOffset - 1].~T();
+        if (--count == 0) {
+            startOffset = endOffset = BLOCK_SIZE / 2;
+        } else {
+            --endOffset;
+            dropEmptyBackBlock();
         }
-        count--;
     }
 
     void pop_front() {
         if (count == 0) throw std::underflow_error("Deque is empty");
-        if (++startOffset == BLOCK_SIZE) {
-            delete[] map[startBlock++];
-            startOffset = 0;
+        map[startBlock][startOffset].~T();
+        if (--count == 0) {
+            startOffset = endOffset = BLOCK_SIZE / 2;
+        } else {
+            ++startOffset;
+            dropEmptyFrontBlock();
         }
-        count--;
     }
 
     T& front() {
@@ -143,11 +717,46 @@ public:
         return map[startBlock][startOffset];
     }
 
+    const T& front() const {
+        if (count == 0) throw std::underflow_error("Deque is empty");
+        return map[startBlock][startOffset];
+    }
+
     T& back() {
         if (count == 0) throw std::underflow_error("Deque is empty");
         return map[endBlock][endOffset - 1];
     }
 
+    const T& back() const {
+        if (count == 0) throw std::underflow_error("Deque is empty");
+        return map[endBlock][endOffset - 1];
+    }
+
+    T& operator[](int index) {
+        return *slot(index);
+    }
+
+    const T& operator[](int index) const {
+        return *slot(index);
+    }
+
+    T& at(int index) {
+        if (index < 0 || index >= count) throw std::out_of_range("Deque index out of range");
+        return *slot(index);
+    }
+
+    const T& at(int index) const {
+        if (index < 0 || index >= count) throw std::out_of_range("Deque index out of range");
+        return *slot(index);
+    }
+
+    iterator begin() { return iterator(map + startBlock, startOffset); }
+    iterator end() { return begin() + count; }
+    const_iterator begin() const { return const_iterator(map + startBlock, startOffset); }
+    const_iterator end() const { return begin() + count; }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
     int size() const {
         return count;
     }
@@ -155,9 +764,934 @@ public:
     int capacity() const {
         return (endBlock - startBlock + 1) * BLOCK_SIZE;
     }
+
+    static int block_size() {
+        return BLOCK_SIZE;
+    }
+
+    int spare_blocks() const {
+        return spareCount;
+    }
+
+    // Changes how many empty blocks are retained; surplus spares are freed.
+    void set_spare_limit(int limit) {
+        if (limit < 0) limit = 0;
+        while (spareCount > limit) {
+            freeBlock(spareBlocks[--spareCount]);
+        }
+        T** newSpares = allocateMap(limit);
+        for (int i = 0; i < spareCount; ++i) {
+            newSpares[i] = spareBlocks[i];
+        }
+        freeMap(spareBlocks, spareLimit);
+        spareBlocks = newSpares;
+        spareLimit = limit;
+    }
+
+    int map_size() const {
+        return mapSize;
+    }
+
+    // Frees the spare blocks and shrinks the map to twice the live blocks.
+    void shrink_to_fit() {
+        releaseSpareBlocks();
+        int target = 8;
+        while (target < (endBlock - startBlock + 1) * 2) {
+            target *= 2;
+        }
+        if (target < mapSize) {
+            reallocateMap(target);
+        }
+    }
+};
+
+// Copy-on-write handle around Deque: copies share one Deque until one of
+// them is mutated, which first clones it (copying only the live blocks).
+// Sharing is tracked with shared_ptr::use_count, so handles sharing a Deque
+// must not be mutated from different threads.
+template<typename T, int BlockSize = DequeBlockTraits<T>::size>
+class CowDeque {
+private:
+    using Storage = Deque<T, BlockSize>;
+
+    std::shared_ptr<Storage> storage;
+
+    Storage& mutate() {
+        if (storage.use_count() > 1) {
+            storage = std::make_shared<Storage>(*storage);
+        }
+        return *storage;
+    }
+
+public:
+    using const_iterator = typename Storage::const_iterator;
+
+    CowDeque() : storage(std::make_shared<Storage>()) {}
+
+    template<typename... Args>
+    T& emplace_back(Args&&... args) {
+        return mutate().emplace_back(std::forward<Args>(args)...);
+    }
+
+    template<typename... Args>
+    T& emplace_front(Args&&... args) {
+        return mutate().emplace_front(std::forward<Args>(args)...);
+    }
+
+    void push_back(const T& value) { mutate().push_back(value); }
+    void push_back(T&& value) { mutate().push_back(std::move(value)); }
+    void push_front(const T& value) { mutate().push_front(value); }
+    void push_front(T&& value) { mutate().push_front(std::move(value)); }
+    void pop_back() { mutate().pop_back(); }
+    void pop_front() { mutate().pop_front(); }
+
+    // Writable access detaches; reads through the const overloads never do.
+    T& at(int index) { return mutate().at(index); }
+    const T& at(int index) const { return storage->at(index); }
+    const T& operator[](int index) const { return (*storage)[index]; }
+    const T& front() const { return storage->front(); }
+    const T& back() const { return storage->back(); }
+
+    const_iterator begin() const { return storage->cbegin(); }
+    const_iterator end() const { return storage->cend(); }
+
+    int size() const { return storage->size(); }
+    bool is_shared() const { return storage.use_count() > 1; }
 };
 
-int main() {
+// Single-producer/single-consumer hand-off queue built on the same block
+// chain as Deque: the producer links fresh blocks after the tail block and
+// the consumer retires blocks from the head. The only shared state is the
+// pair of position counters, the block links and one recycled spare block.
+template<typename T, int BlockSize = DequeBlockTraits<T>::size>
+class SpscDeque {
+private:
+    static_assert(BlockSize >= 1, "SpscDeque block size must be positive");
+
+    static const int BLOCK_SIZE = BlockSize;
+
+    struct Block {
+        alignas(T) unsigned char storage[sizeof(T) * BLOCK_SIZE];
+        std::atomic<Block*> next;
+
+        Block() : next(nullptr) {}
+
+        T* slot(int i) { return reinterpret_cast<T*>(storage) + i; }
+    };
+
+    // Consumer side.
+    alignas(64) std::atomic<long long> head;
+    Block* headBlock;
+    long long cachedTail;
+
+    // Producer side.
+    alignas(64) std::atomic<long long> tail;
+    Block* tailBlock;
+
+    alignas(64) std::atomic<Block*> spare;
+
+    void retireBlock(Block* block) {
+        delete spare.exchange(block, std::memory_order_acq_rel);
+    }
+
+public:
+    SpscDeque() : head(0), cachedTail(0), tail(0), spare(nullptr) {
+        headBlock = tailBlock = new Block;
+    }
+
+    SpscDeque(const SpscDeque&) = delete;
+    SpscDeque& operator=(const SpscDeque&) = delete;
+
+    ~SpscDeque() {
+        long long h = head.load(std::memory_order_relaxed);
+        long long t = tail.load(std::memory_order_relaxed);
+        for (; h < t; ++h) {
+            int offset = static_cast<int>(h % BLOCK_SIZE);
+            if (offset == 0 && h != 0) {
+                Block* next = headBlock->next.load(std::memory_order_relaxed);
+                delete headBlock;
+                headBlock = next;
+            }
+            headBlock->slot(offset)->~T();
+        }
+        while (headBlock) {
+            Block* next = headBlock->next.load(std::memory_order_relaxed);
+            delete headBlock;
+            headBlock = next;
+        }
+        delete spare.load(std::memory_order_relaxed);
+    }
+
+    // Producer thread only.
+    template<typename... Args>
+    void emplace_back(Args&&... args) {
+        long long t = tail.load(std::memory_order_relaxed);
+        int offset = static_cast<int>(t % BLOCK_SIZE);
+        if (offset == 0 && t != 0) {
+            Block* block = spare.exchange(nullptr, std::memory_order_acquire);
+            if (block) {
+                block->next.store(nullptr, std::memory_order_relaxed);
+            } else {
+                block = new Block;
+            }
+            // Build the element before linking the block, so a throwing
+            // constructor leaves the chain as it was.
+            try {
+                ::new (static_cast<void*>(block->slot(0))) T(std::forward<Args>(args)...);
+            } catch (...) {
+                retireBlock(block);
+                throw;
+            }
+            tailBlock->next.store(block, std::memory_order_release);
+            tailBlock = block;
+        } else {
+            ::new (static_cast<void*>(tailBlock->slot(offset))) T(std::forward<Args>(args)...);
+        }
+        tail.store(t + 1, std::memory_order_release);
+    }
+
+    void push_back(const T& value) {
+        emplace_back(value);
+    }
+
+    void push_back(T&& value) {
+        emplace_back(std::move(value));
+    }
+
+    // Consumer thread only. Returns false instead of blocking when empty.
+    bool try_pop_front(T& out) {
+        long long h = head.load(std::memory_order_relaxed);
+        if (h == cachedTail) {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if (h == cachedTail) return false;
+        }
+        int offset = static_cast<int>(h % BLOCK_SIZE);
+        if (offset == 0 && h != 0) {
+            Block* next = headBlock->next.load(std::memory_order_acquire);
+            retireBlock(headBlock);
+            headBlock = next;
+        }
+        T* p = headBlock->slot(offset);
+        out = std::move(*p);
+        p->~T();
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Exact only when called from one of the two threads while the other is idle.
+    int size() const {
+        return static_cast<int>(tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire));
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+};
+
+// Chase-Lev work-stealing deque (Le et al., "Correct and Efficient
+// Work-Stealing for Weak Memory Models"). The owning thread pushes and
+// pops at the bottom; any other thread may steal from the top. Storage is
+// a growable circular buffer; outgrown buffers are kept until destruction
+// because a concurrent thief may still be reading from them.
+template<typename T>
+class WorkStealingDeque {
+private:
+    static_assert(std::is_trivially_copyable<T>::value, "stolen elements are copied racily and must be trivially copyable");
+
+    struct Buffer {
+        long long capacity;
+        long long mask;
+        std::atomic<T>* slots;
+
+        explicit Buffer(long long capacity)
+            : capacity(capacity), mask(capacity - 1), slots(new std::atomic<T>[capacity]) {}
+
+        ~Buffer() {
+            delete[] slots;
+        }
+
+        T load(long long i) const {
+            return slots[i & mask].load(std::memory_order_relaxed);
+        }
+
+        void store(long long i, const T& value) {
+            slots[i & mask].store(value, std::memory_order_relaxed);
+        }
+    };
+
+    alignas(64) std::atomic<long long> top;
+    alignas(64) std::atomic<long long> bottom;
+    std::atomic<Buffer*> buffer;
+    std::vector<Buffer*> retired;
+
+    Buffer* grow(Buffer* old, long long b, long long t) {
+        Buffer* bigger = new Buffer(old->capacity * 2);
+        for (long long i = t; i < b; ++i) {
+            bigger->store(i, old->load(i));
+        }
+        retired.push_back(old);
+        buffer.store(bigger, std::memory_order_release);
+        return bigger;
+    }
+
+public:
+    explicit WorkStealingDeque(long long initialCapacity = 1024) : top(0), bottom(0) {
+        long long capacity = 1;
+        while (capacity < initialCapacity) capacity *= 2;
+        buffer.store(new Buffer(capacity), std::memory_order_relaxed);
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    ~WorkStealingDeque() {
+        delete buffer.load(std::memory_order_relaxed);
+        for (Buffer* old : retired) {
+            delete old;
+        }
+    }
+
+    // Owner thread only.
+    void push_back(const T& value) {
+        long long b = bottom.load(std::memory_order_relaxed);
+        long long t = top.load(std::memory_order_acquire);
+        Buffer* buf = buffer.load(std::memory_order_relaxed);
+        if (b - t > buf->capacity - 1) {
+            buf = grow(buf, b, t);
+        }
+        buf->store(b, value);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // Owner thread only.
+    bool try_pop_back(T& out) {
+        long long b = bottom.load(std::memory_order_relaxed) - 1;
+        Buffer* buf = buffer.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long long t = top.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        out = buf->load(b);
+        if (t == b) {
+            // Last element: race the thieves for it.
+            bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // Any thread.
+    bool try_steal(T& out) {
+        long long t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long long b = bottom.load(std::memory_order_acquire);
+        if (t >= b) return false;
+
+        Buffer* buf = buffer.load(std::memory_order_acquire);
+        out = buf->load(t);
+        return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+    int size() const {
+        long long b = bottom.load(std::memory_order_relaxed);
+        long long t = top.load(std::memory_order_relaxed);
+        return b > t ? static_cast<int>(b - t) : 0;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+};
+
+// Pushes and pops across a block boundary, the worst case for block churn.
+void benchmarkBoundaryOscillation(int spareLimit, int rounds) {
+    Deque<int> d(spareLimit);
+    for (int i = 0; i < Deque<int>::block_size() / 2; ++i) d.push_back(i);
+
+    long long allocsBefore = heapAllocations;
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; ++r) {
+        d.push_back(r);
+        d.pop_back();
+        d.push_front(r);
+        d.pop_front();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    long long allocs = heapAllocations - allocsBefore;
+
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+    std::cout << "  spare limit " << spareLimit << ": "
+              << ns / (rounds * 4.0) << " ns/op, "
+              << allocs << " heap allocations\n";
+}
+
+// Same element sequence in both containers, so only the traversal differs.
+void benchmarkIteration(int n) {
+    std::mt19937 rng(42);
+    std::vector<int> values(n);
+    for (int& v : values) v = static_cast<int>(rng() % 1000000);
+
+    Deque<int> d;
+    std::deque<int> sd;
+    for (int v : values) {
+        d.push_back(v);
+        sd.push_back(v);
+    }
+
+    long long sink = 0;
+    double dAcc = timeNs([&] { sink += std::accumulate(d.begin(), d.end(), 0LL); });
+    double sdAcc = timeNs([&] { sink += std::accumulate(sd.begin(), sd.end(), 0LL); });
+    double dIdx = timeNs([&] { for (int i = 0; i < n; ++i) sink += d[i]; });
+    double sdIdx = timeNs([&] { for (int i = 0; i < n; ++i) sink += sd[i]; });
+    double dSort = timeNs([&] { std::sort(d.begin(), d.end()); });
+    double sdSort = timeNs([&] { std::sort(sd.begin(), sd.end()); });
+    const int queries = n / 10;
+    double dFind = timeNs([&] {
+        for (int i = 0; i < queries; ++i) sink += *std::lower_bound(d.begin(), d.end(), values[i]);
+    });
+    double sdFind = timeNs([&] {
+        for (int i = 0; i < queries; ++i) sink += *std::lower_bound(sd.begin(), sd.end(), values[i]);
+    });
+
+    std::cout << "  accumulate:  Deque " << dAcc / n << " ns/elem, std::deque " << sdAcc / n << " ns/elem\n";
+    std::cout << "  operator[]:  Deque " << dIdx / n << " ns/elem, std::deque " << sdIdx / n << " ns/elem\n";
+    std::cout << "  sort:        Deque " << dSort / 1e6 << " ms, std::deque " << sdSort / 1e6 << " ms\n";
+    std::cout << "  lower_bound: Deque " << dFind / queries << " ns/query, std::deque " << sdFind / queries << " ns/query\n";
+    benchmarkSink = sink;
+}
+
+void benchmarkIngest(int n) {
+    std::vector<int> values(n);
+    std::iota(values.begin(), values.end(), 0);
+    double bytes = static_cast<double>(n) * sizeof(int);
+
+    double pushNs = timeNs([&] {
+        Deque<int> d;
+        for (int v : values) d.push_back(v);
+        benchmarkSink = d.back();
+    });
+    double appendNs = timeNs([&] {
+        Deque<int> d;
+        d.append(values.data(), values.data() + n);
+        benchmarkSink = d.back();
+    });
+    double prependNs = timeNs([&] {
+        Deque<int> d;
+        d.prepend(values.data(), values.data() + n);
+        benchmarkSink = d.front();
+    });
+    double stdNs = timeNs([&] {
+        std::deque<int> d(values.begin(), values.end());
+        benchmarkSink = d.back();
+    });
+
+    std::cout << "  push_back loop:  " << bytes / pushNs << " GB/s\n";
+    std::cout << "  append:          " << bytes / appendNs << " GB/s\n";
+    std::cout << "  prepend:         " << bytes / prependNs << " GB/s\n";
+    std::cout << "  std::deque(range): " << bytes / stdNs << " GB/s\n";
+}
+
+template<int Bytes>
+struct Payload {
+    unsigned char bytes[Bytes];
+};
+
+// FIFO fill-then-drain of about 64 MiB, one block geometry at a time.
+template<typename T, int BlockBytes>
+double benchmarkBlockGeometry() {
+    const int n = static_cast<int>((64u << 20) / sizeof(T));
+    constexpr int blockSize = BlockBytes / sizeof(T) > 2 ? static_cast<int>(BlockBytes / sizeof(T)) : 2;
+    T value{};
+    double ns = timeNs([&] {
+        Deque<T, blockSize> d;
+        for (int i = 0; i < n; ++i) d.push_back(value);
+        for (int i = 0; i < n; ++i) d.pop_front();
+    });
+    return ns / (2.0 * n);
+}
+
+template<typename T>
+void benchmarkElementSize(const char* name) {
+    std::cout << "  " << name
+              << "\t" << benchmarkBlockGeometry<T, 256>()
+              << "\t" << benchmarkBlockGeometry<T, 1024>()
+              << "\t" << benchmarkBlockGeometry<T, 4096>()
+              << "\t" << benchmarkBlockGeometry<T, 16384>()
+              << "\t" << benchmarkBlockGeometry<T, 65536>()
+              << "\t(default: " << Deque<T>::block_size() << " elements)\n";
+}
+
+// Many short-lived deques, as in per-request scratch queues.
+template<typename MakeDeque>
+void benchmarkRequests(const char* name, int requests, MakeDeque makeDeque) {
+    long long allocsBefore = heapAllocations;
+    double ns = timeNs([&] {
+        for (int r = 0; r < requests; ++r) {
+            makeDeque([&](auto& d) {
+                for (int i = 0; i < 3000; ++i) d.push_back(i);
+                for (int i = 0; i < 1000; ++i) d.pop_front();
+                benchmarkSink = d.front();
+            });
+        }
+    });
+    long long allocs = heapAllocations - allocsBefore;
+    std::cout << "  " << name << ": " << ns / requests << " ns/request, "
+              << static_cast<double>(allocs) / requests << " heap allocations/request\n";
+}
+
+void benchmarkAllocators(int requests) {
+    benchmarkRequests("std::allocator", requests, [](auto work) {
+        Deque<int> d;
+        work(d);
+    });
+
+    alignas(64) static unsigned char arena[1 << 16];
+    benchmarkRequests("pmr monotonic arena", requests, [](auto work) {
+        std::pmr::monotonic_buffer_resource resource(arena, sizeof(arena), std::pmr::null_memory_resource());
+        Deque<int, DequeBlockTraits<int>::size, std::pmr::polymorphic_allocator<int>> d(&resource);
+        work(d);
+    });
+}
+
+// Deque behind a mutex, with the same interface as SpscDeque.
+class LockedDeque {
+private:
+    std::mutex mutex;
+    Deque<long long> items;
+
+public:
+    void push_back(long long value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        items.push_back(value);
+    }
+
+    bool try_pop_front(long long& out) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.size() == 0) return false;
+        out = items.front();
+        items.pop_front();
+        return true;
+    }
+};
+
+// Throughput: the producer pushes n elements back to back. Latency: the
+// producer sends one timestamp at a time and waits for the consumer to
+// echo it on a second queue, so each sample is a single round trip with
+// nothing queued ahead of it.
+template<typename Queue>
+void benchmarkHandoff(const char* name, int n, int pings) {
+    using Clock = std::chrono::steady_clock;
+    auto nowNs = [] {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+    };
+
+    Queue queue;
+    auto start = Clock::now();
+    std::thread consumer([&] {
+        long long value;
+        for (int received = 0; received < n;) {
+            if (queue.try_pop_front(value)) {
+                ++received;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+    for (int i = 0; i < n; ++i) {
+        queue.push_back(i);
+    }
+    consumer.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    Queue ping, pong;
+    std::vector<long long> latencies;
+    latencies.reserve(pings);
+    std::thread echo([&] {
+        long long value;
+        for (int received = 0; received < pings;) {
+            if (ping.try_pop_front(value)) {
+                pong.push_back(value);
+                ++received;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+    for (int i = 0; i < pings; ++i) {
+        ping.push_back(nowNs());
+        long long sent;
+        while (!pong.try_pop_front(sent)) {
+            std::this_thread::yield();
+        }
+        latencies.push_back(nowNs() - sent);
+    }
+    echo.join();
+
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << "  " << name << ": " << n / seconds / 1e6 << " Mops/s, round trip p50 "
+              << latencies[latencies.size() / 2] << " ns, p99 "
+              << latencies[latencies.size() * 99 / 100] << " ns\n";
+}
+
+void benchmarkSpsc(int n) {
+    benchmarkHandoff<LockedDeque>("mutex + Deque", n, 20000);
+    benchmarkHandoff<SpscDeque<long long>>("SpscDeque", n, 20000);
+}
+
+// Recursive task spawning on a pool of work-stealing workers: a task of
+// depth d pushes tasks of depth d-1..0 onto its own deque, so each root
+// expands into 2^d units of work. Idle workers steal from random victims.
+long long runWorkStealingPool(int threads, int rootTasks, int depth) {
+    std::vector<std::unique_ptr<WorkStealingDeque<int>>> queues;
+    for (int i = 0; i < threads; ++i) {
+        queues.push_back(std::make_unique<WorkStealingDeque<int>>());
+    }
+    for (int i = 0; i < rootTasks; ++i) {
+        queues[i % threads]->push_back(depth);
+    }
+
+    const long long totalLeaves = static_cast<long long>(rootTasks) << depth;
+    std::atomic<long long> leavesDone(0);
+    std::atomic<long long> checksum(0);
+
+    auto worker = [&](int self) {
+        std::mt19937 rng(self);
+        long long localSum = 0;
+        int task;
+        while (leavesDone.load(std::memory_order_relaxed) < totalLeaves) {
+            bool found = queues[self]->try_pop_back(task);
+            for (int attempt = 0; !found && attempt < threads; ++attempt) {
+                int victim = static_cast<int>(rng() % threads);
+                if (victim != self) found = queues[victim]->try_steal(task);
+            }
+            if (!found) {
+                std::this_thread::yield();
+                continue;
+            }
+            while (task > 0) {
+                queues[self]->push_back(--task);
+            }
+            // Leaf work: a short dependent arithmetic chain.
+            unsigned x = static_cast<unsigned>(self + 1);
+            for (int i = 0; i < 2000; ++i) x = x * 1664525u + 1013904223u;
+            localSum += x & 1;
+            leavesDone.fetch_add(1, std::memory_order_relaxed);
+        }
+        checksum.fetch_add(localSum);
+    };
+
+    std::vector<std::thread> pool;
+    for (int i = 1; i < threads; ++i) pool.emplace_back(worker, i);
+    worker(0);
+    for (std::thread& t : pool) t.join();
+    return checksum.load();
+}
+
+void benchmarkWorkStealing() {
+    int maxThreads = static_cast<int>(std::thread::hardware_concurrency());
+    if (maxThreads < 1) maxThreads = 1;
+    std::vector<int> counts;
+    for (int threads = 1; threads < maxThreads; threads *= 2) counts.push_back(threads);
+    counts.push_back(maxThreads);
+
+    double baseline = 0;
+    for (int threads : counts) {
+        double ns = timeNs([&] { benchmarkSink = runWorkStealingPool(threads, 64, 10); });
+        if (threads == 1) baseline = ns;
+        std::cout << "  " << threads << " thread(s): " << ns / 1e6 << " ms, speedup " << baseline / ns << "x\n";
+    }
+}
+
+// Steady-state FIFO of fixed length: the map must not grow with the number
+// of operations, only with the number of live blocks.
+void runSoak(long long ops) {
+    const int live = 10000;
+    Deque<int> d;
+    for (int i = 0; i < live; ++i) d.push_back(i);
+
+    int maxMapSize = d.map_size();
+    auto start = std::chrono::steady_clock::now();
+    for (long long i = 0; i < ops; i += 2) {
+        d.push_back(static_cast<int>(i));
+        d.pop_front();
+        if ((i & ((1 << 24) - 1)) == 0 && d.map_size() > maxMapSize) {
+            maxMapSize = d.map_size();
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (d.map_size() > maxMapSize) maxMapSize = d.map_size();
+
+    std::cout << "Soak: " << ops << " ops on a " << live << "-element FIFO in " << seconds << " s\n";
+    std::cout << "  live blocks: " << d.capacity() / Deque<int>::block_size()
+              << ", map size: " << d.map_size() << " (max seen " << maxMapSize << ")\n";
+}
+
+// Element whose construction throws for negative values.
+struct ThrowOnNegative {
+    int value;
+
+    ThrowOnNegative(int v) : value(v) {
+        if (v < 0) throw std::runtime_error("negative value");
+    }
+};
+
+// A push that throws at a block boundary must leave the queue as it was.
+bool checkSpscThrowingPush() {
+    SpscDeque<ThrowOnNegative, 2> queue;
+    queue.emplace_back(1);
+    queue.emplace_back(2);
+    try {
+        queue.emplace_back(-1);
+        return false;
+    } catch (const std::runtime_error&) {
+    }
+    queue.emplace_back(3);
+    queue.emplace_back(4);
+    queue.emplace_back(5);
+    ThrowOnNegative out(0);
+    for (int expected = 1; expected <= 5; ++expected) {
+        if (!queue.try_pop_front(out) || out.value != expected) return false;
+    }
+    return !queue.try_pop_front(out);
+}
+
+// A moved-from deque must still accept pushes like a freshly built one.
+static_assert(std::is_nothrow_move_constructible<Deque<int>>::value, "moving a Deque must not allocate");
+
+bool checkMovedFromDeque() {
+    Deque<int> source;
+    for (int i = 0; i < 100; ++i) source.push_back(i);
+    Deque<int> moved(std::move(source));
+    source.push_back(1);
+    source.push_front(0);
+    Deque<int> assigned;
+    assigned.push_back(7);
+    assigned = std::move(moved);
+    moved.push_back(2);
+
+    // Every other entry point must also cope with a deque that has no map.
+    Deque<int> a(std::move(assigned)), b(std::move(a)), c(std::move(b)), d(std::move(c));
+    Deque<int> copy(assigned);
+    copy.push_back(3);
+    int values[] = {4, 5, 6};
+    a.prepend(values, values + 3);
+    b.append(values, values + 3);
+    c.clear();
+    c.shrink_to_fit();
+    c = copy;
+    Deque<int> target;
+    target = d;
+    return source.size() == 2 && source.front() == 0 && source.back() == 1 &&
+           moved.size() == 1 && moved.front() == 2 && assigned.size() == 0 &&
+           copy.size() == 1 && a.size() == 3 && a.front() == 4 && b.back() == 6 &&
+           c.size() == 1 && c.back() == 3 && target.size() == 100 && target.back() == 99 &&
+           std::distance(assigned.begin(), assigned.end()) == 0;
+}
+
+struct CopyCounted {
+    static int live;
+    int value;
+
+    CopyCounted(int v) : value(v) { ++live; }
+    CopyCounted(const CopyCounted& other) : value(other.value) {
+        if (value < 0) throw std::runtime_error("copy of a negative value");
+        ++live;
+    }
+    ~CopyCounted() { --live; }
+};
+
+int CopyCounted::live = 0;
+
+// A copy that throws several blocks in must destroy what it already built.
+bool checkThrowingDequeCopy() {
+    Deque<CopyCounted, 4> source;
+    for (int i = 0; i < 10; ++i) source.emplace_back(i);
+    source.emplace_back(-1);
+    try {
+        Deque<CopyCounted, 4> copy(source);
+        return false;
+    } catch (const std::runtime_error&) {
+    }
+    return CopyCounted::live == source.size();
+}
+
+// Quick correctness checks; returns the number of failures.
+int runChecks() {
+    struct Check {
+        const char* name;
+        bool (*run)();
+    };
+    const Check checks[] = {
+        {"SpscDeque push that throws at a block boundary", checkSpscThrowingPush},
+        {"Deque is usable after being moved from", checkMovedFromDeque},
+        {"Deque copy that throws partway releases what it built", checkThrowingDequeCopy},
+    };
+    int failures = 0;
+    for (const Check& check : checks) {
+        bool passed = check.run();
+        std::cout << (passed ? "ok   " : "FAIL ") << check.name << "\n";
+        if (!passed) ++failures;
+    }
+    return failures;
+}
+
+void benchmarkSnapshots(int n) {
+    std::vector<int> values(n);
+    std::iota(values.begin(), values.end(), 0);
+    Deque<int> source;
+    source.append(values.data(), values.data() + n);
+    std::deque<int> stdSource(values.begin(), values.end());
+
+    auto report = [](const char* name, double ns, long long allocs) {
+        std::cout << "  " << name << ": " << ns / 1e6 << " ms, " << allocs << " heap allocations\n";
+    };
+
+    long long before = heapAllocations;
+    double ns = timeNs([&] {
+        Deque<int> copy(source);
+        benchmarkSink = copy.back();
+    });
+    report("Deque copy", ns, heapAllocations - before);
+
+    Deque<int> target(source);
+    target.pop_back();
+    before = heapAllocations;
+    ns = timeNs([&] { target = source; });
+    report("Deque assign (blocks reused)", ns, heapAllocations - before);
+
+    before = heapAllocations;
+    ns = timeNs([&] {
+        std::deque<int> copy(stdSource);
+        benchmarkSink = copy.back();
+    });
+    report("std::deque copy", ns, heapAllocations - before);
+
+    CowDeque<int> cow;
+    for (int i = 0; i < n; ++i) cow.push_back(i);
+    before = heapAllocations;
+    ns = timeNs([&] {
+        CowDeque<int> snapshot(cow);
+        benchmarkSink = snapshot.back();
+    });
+    report("CowDeque snapshot", ns, heapAllocations - before);
+
+    CowDeque<int> snapshot(cow);
+    before = heapAllocations;
+    ns = timeNs([&] { cow.push_back(-1); });
+    report("CowDeque first write after snapshot", ns, heapAllocations - before);
+}
+
+void runBenchmarks() {
+    if (!heapAllocationsCounted) {
+        std::cout << "(heap allocations read 0: build with -DBENCH_COUNT_ALLOCATIONS to count them)\n";
+    }
+    const int rounds = 10000000;
+    std::cout << "Boundary oscillation (" << rounds * 4LL << " ops):\n";
+    benchmarkBoundaryOscillation(0, rounds);
+    benchmarkBoundaryOscillation(2, rounds);
+
+    const int n = 10000000;
+    std::cout << "Iteration over " << n << " ints:\n";
+    benchmarkIteration(n);
+
+    std::cout << "Bulk ingest of " << n << " ints:\n";
+    benchmarkIngest(n);
+
+    std::cout << "Block size matrix, ns/op (rows: element bytes, columns: block bytes):\n";
+    std::cout << "  elem\t256\t1K\t4K\t16K\t64K\n";
+    benchmarkElementSize<char>("1");
+    benchmarkElementSize<int>("4");
+    benchmarkElementSize<Payload<16>>("16");
+    benchmarkElementSize<Payload<64>>("64");
+    benchmarkElementSize<Payload<256>>("256");
+    benchmarkElementSize<Payload<1024>>("1024");
+
+    std::cout << "Short-lived deques (3000 pushes each):\n";
+    benchmarkAllocators(100000);
+
+    std::cout << "Snapshots of " << n << " ints:\n";
+    benchmarkSnapshots(n);
+
+    std::cout << "SPSC hand-off (" << n / 5 << " elements):\n";
+    benchmarkSpsc(n / 5);
+
+    std::cout << "Work-stealing pool scaling:\n";
+    benchmarkWorkStealing();
+}
+
+enum Opcode {
+    OP_PUSH_FRONT,
+    OP_PUSH_BACK,
+    OP_POP_FRONT,
+    OP_POP_BACK,
+    OP_FRONT,
+    OP_BACK,
+    OP_SIZE,
+    OP_CAPACITY,
+    OP_SHRINK_TO_FIT,
+    OP_EXIT,
+    OP_COUNT
+};
+
+// Indexed by Opcode.
+static const CommandInfo COMMANDS[OP_COUNT] = {
+    {"push_front", true},
+    {"push_back", true},
+    {"pop_front", false},
+    {"pop_back", false},
+    {"front", false},
+    {"back", false},
+    {"size", false},
+    {"capacity", false},
+    {"shrink_to_fit", false},
+    {"exit", false},
+};
+
+int runBatch(const std::string& path) {
+    Deque<int> d;
+    return runReplay(path, COMMANDS, OP_COUNT, OP_EXIT, "Unknown command.", [&](int op, int value, OutputBuffer& out) {
+        switch (op) {
+        case OP_PUSH_FRONT: d.push_front(value); break;
+        case OP_PUSH_BACK: d.push_back(value); break;
+        case OP_POP_FRONT: d.pop_front(); break;
+        case OP_POP_BACK: d.pop_back(); break;
+        case OP_FRONT: out.appendLine("Front: ", d.front()); break;
+        case OP_BACK: out.appendLine("Back: ", d.back()); break;
+        case OP_SIZE: out.appendLine("Size: ", d.size()); break;
+        case OP_CAPACITY: out.appendLine("Capacity: ", d.capacity()); break;
+        case OP_SHRINK_TO_FIT: d.shrink_to_fit(); break;
+        default: break;
+        }
+    });
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "--bench") {
+        runBenchmarks();
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--batch") {
+        try {
+            return runBatch(argc > 2 ? argv[2] : "-");
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+    }
+    if (argc > 1 && std::string(argv[1]) == "--check") {
+        return runChecks() == 0 ? 0 : 1;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--soak") {
+        runSoak(argc > 2 ? std::atoll(argv[2]) : 1000000000LL);
+        return 0;
+    }
+
     Deque<int> d;
     std::string command;
     int value;
@@ -171,6 +1705,7 @@ int main() {
     std::cout << "  back\n";
     std::cout << "  size\n";
     std::cout << "  capacity\n";
+    std::cout << "  shrink_to_fit\n";
     std::cout << "  exit\n";
 
     while (true) {
@@ -196,6 +1731,8 @@ int main() {
                 std::cout << "Size: " << d.size() << "\n";
             } else if (command == "capacity") {
                 std::cout << "Capacity: " << d.capacity() << "\n";
+            } else if (command == "shrink_to_fit") {
+                d.shrink_to_fit();
             } else if (command == "exit") {
                 break;
             } else {
@@ -2,20 +2,42 @@
 #include <stdexcept>
 #include <string>
 #include <cstring>  
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <optional>
+#include <memory>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <random>
+#include "replay.h"
+#include "bench.h"
 template<typename T>
 class Deque {
 private:
     static const int BLOCK_SIZE = 64;
+
+    // Blocks are raw, uninitialized storage; only the slots between
+    // (startBlock, startOffset) and (endBlock, endOffset) hold live objects.
     T** map;
     int mapSize;
     int startBlock, startOffset;
     int endBlock, endOffset;
     int count;
 
+    static T* allocateBlock() {
+        return static_cast<T*>(::operator new(sizeof(T) * BLOCK_SIZE));
+    }
+
+    static void freeBlock(T* block) {
+        ::operator delete(block);
+    }
+
     void reallocateMap(int newMapSize) {
         int newCenter = newMapSize / 2;
         T** newMap = new T*[newMapSize];
-        memset(newMap, 0, sizeof(T*) * newMapSize);
+        std::memset(newMap, 0, sizeof(T*) * newMapSize);
 
         int offset = newCenter - (endBlock - startBlock) / 2;
         for (int i = startBlock; i <= endBlock; ++i) {
@@ -30,52 +52,129 @@ private:
     }
 
     void ensureFrontCapacity() {
+        if (!map) allocateEmptyLayout();
         if (startOffset == 0) {
             if (startBlock == 0) {
                 reallocateMap(mapSize * 2);
             }
-            map[--startBlock] = new T[BLOCK_SIZE];
+            map[--startBlock] = allocateBlock();
             startOffset = BLOCK_SIZE;
         }
     }
 
     void ensureBackCapacity() {
+        if (!map) allocateEmptyLayout();
         if (endOffset == BLOCK_SIZE) {
             if (endBlock == mapSize - 1) {
                 reallocateMap(mapSize * 2);
             }
-            map[++endBlock] = new T[BLOCK_SIZE];
+            map[++endBlock] = allocateBlock();
             endOffset = 0;
         }
     }
 
+    // Undo an ensure*Capacity whose fresh block never received its element.
+    void dropEmptyFrontBlock() {
+        if (startOffset == BLOCK_SIZE && startBlock < endBlock) {
+            freeBlock(map[startBlock]);
+            map[startBlock++] = nullptr;
+            startOffset = 0;
+        }
+    }
+
+    void dropEmptyBackBlock() {
+        if (endOffset == 0 && endBlock > startBlock) {
+            freeBlock(map[endBlock]);
+            map[endBlock--] = nullptr;
+            endOffset = BLOCK_SIZE;
+        }
+    }
+
+    T* slot(int index) const {
+        int pos = startOffset + index;
+        return map[startBlock + pos / BLOCK_SIZE] + pos % BLOCK_SIZE;
+    }
+
+    void destroyElements() {
+        if (!std::is_trivially_destructible<T>::value) {
+            for (int i = 0; i < count; ++i) {
+                slot(i)->~T();
+            }
+        }
+        count = 0;
+    }
+
     void cleanup() {
+        destroyElements();
         for (int i = startBlock; i <= endBlock; ++i) {
-            delete[] map[i];
+            freeBlock(map[i]);
         }
         delete[] map;
     }
 
+    // A moved-from deque has no map; its next push allocates one here.
+    void allocateEmptyLayout() {
+        T** newMap = new T*[8];
+        std::memset(newMap, 0, sizeof(T*) * 8);
+        try {
+            newMap[4] = allocateBlock();
+        } catch (...) {
+            delete[] newMap;
+            throw;
+        }
+        map = newMap;
+        mapSize = 8;
+        startBlock = endBlock = 4;
+    }
+
+    // The state a move leaves behind: empty, owning nothing.
+    void dropLayout() {
+        map = nullptr;
+        mapSize = 0;
+        startBlock = 0;
+        endBlock = -1;
+        startOffset = endOffset = BLOCK_SIZE / 2;
+        count = 0;
+    }
+
+
+    void copyElements(const Deque& other) {
+        if (!other.map) {
+            dropLayout();
+            return;
+        }
+        map = new T*[mapSize];
+        std::memset(map, 0, sizeof(T*) * mapSize);
+        for (int i = startBlock; i <= endBlock; ++i) {
+            map[i] = allocateBlock();
+        }
+        count = 0;
+        for (int i = 0; i < other.count; ++i) {
+            ::new (static_cast<void*>(slot(i))) T(*other.slot(i));
+            count++;
+        }
+    }
+
 public:
     Deque()
         : mapSize(8), startBlock(4), endBlock(4), startOffset(BLOCK_SIZE / 2), endOffset(BLOCK_SIZE / 2), count(0) {
         map = new T*[mapSize];
-        memset(map, 0, sizeof(T*) * mapSize);
-        map[startBlock] = new T[BLOCK_SIZE];
+        std::memset(map, 0, sizeof(T*) * mapSize);
+        map[startBlock] = allocateBlock();
     }
 
     Deque(const Deque& other)
         : mapSize(other.mapSize), startBlock(other.startBlock), endBlock(other.endBlock),
-          startOffset(other.startOffset), endOffset(other.endOffset), count(other.count) {
-        map = new T*[mapSize];
-        for (int i = 0; i < mapSize; ++i) {
-            if (other.map[i]) {
-                map[i] = new T[BLOCK_SIZE];
-                std::copy(other.map[i], other.map[i] + BLOCK_SIZE, map[i]);
-            } else {
-                map[i] = nullptr;
-            }
-        }
+          startOffset(other.startOffset), endOffset(other.endOffset), count(0) {
+        copyElements(other);
+    }
+
+    // Steals other's map and blocks. other is left empty without a map and
+    // allocates one again on its next push.
+    Deque(Deque&& other) noexcept
+        : map(other.map), mapSize(other.mapSize), startBlock(other.startBlock), startOffset(other.startOffset),
+          endBlock(other.endBlock), endOffset(other.endOffset), count(other.count) {
+        other.dropLayout();
     }
 
     Deque& operator=(const Deque& other) {
@@ -87,17 +186,25 @@ public:
         endBlock = other.endBlock;
         startOffset = other.startOffset;
         endOffset = other.endOffset;
+        copyElements(other);
+
+        return *this;
+    }
+
+    Deque& operator=(Deque&& other) noexcept {
+        if (this == &other) return *this;
+
+        cleanup();
+
+        map = other.map;
+        mapSize = other.mapSize;
+        startBlock = other.startBlock;
+        endBlock = other.endBlock;
+        startOffset = other.startOffset;
+        endOffset = other.endOffset;
         count = other.count;
 
-        map = new T*[mapSize];
-        for (int i = 0; i < mapSize; ++i) {
-            if (other.map[i]) {
-                map[i] = new T[BLOCK_SIZE];
-                std::copy(other.map[i], other.map[i] + BLOCK_SIZE, map[i]);
-            } else {
-                map[i] = nullptr;
-            }
-        }
+        other.dropLayout();
 
         return *this;
     }
@@ -106,34 +213,74 @@ public:
         cleanup();
     }
 
-    void push_back(const T& value) {
+    template<typename... Args>
+    T& emplace_back(Args&&... args) {
         ensureBackCapacity();
-        map[endBlock][endOffset++] = value;
+        T* p = map[endBlock] + endOffset;
+        try {
+            ::new (static_cast<void*>(p)) T(std::forward<Args>(args)...);
+        } catch (...) {
+            dropEmptyBackBlock();
+            throw;
+        }
+        endOffset++;
         count++;
+        return *p;
     }
 
-    void push_front(const T& value) {
+    template<typename... Args>
+    T& emplace_front(Args&&... args) {
         ensureFrontCapacity();
-        map[startBlock][--startOffset] = value;
+        T* p = map[startBlock] + startOffset - 1;
+        try {
+            ::new (static_cast<void*>(p)) T(std::forward<Args>(args)...);
+        } catch (...) {
+            dropEmptyFrontBlock();
+            throw;
+        }
+        startOffset--;
         count++;
+        return *p;
     }
 
+    void push_back(const T& value) {
+        emplace_back(value);
+    }
+
+    void push_back(T&& value) {
+        emplace_back(std::move(value));
+    }
+
+    void push_front(const T& value) {
+        emplace_front(value);
+    }
+
+    void push_front(T&& value) {
+        emplace_front(std::move(value));
+    }
+
+    // A block is handed back as soon as it holds no live element, so the
+    // back block always has 1..BLOCK_SIZE elements and back() stays valid.
     void pop_back() {
         if (count == 0) throw std::underflow_error("Deque is empty");
-        if (--endOffset < 0) {
-            delete[] map[endBlock--];
-            endOffset = BLOCK_SIZE - 1;
+        map[endBlock][endOffset - 1].~T();
+        if (--count == 0) {
+            startOffset = endOffset = BLOCK_SIZE / 2;
+        } else {
+            --endOffset;
+            dropEmptyBackBlock();
         }
-        count--;
     }
 
     void pop_front() {
         if (count == 0) throw std::underflow_error("Deque is empty");
-        if (++startOffset == BLOCK_SIZE) {
-            delete[] map[startBlock++];
-            startOffset = 0;
+        map[startBlock][startOffset].~T();
+        if (--count == 0) {
+            startOffset = endOffset = BLOCK_SIZE / 2;
+        } else {
+            ++startOffset;
+            dropEmptyFrontBlock();
         }
-        count--;
     }
 
     T& front() {
@@ -141,11 +288,48 @@ public:
         return map[startBlock][startOffset];
     }
 
+    const T& front() const {
+        if (count == 0) throw std::underflow_error("Deque is empty");
+        return map[startBlock][startOffset];
+    }
+
     T& back() {
         if (count == 0) throw std::underflow_error("Deque is empty");
         return map[endBlock][endOffset - 1];
     }
 
+    const T& back() const {
+        if (count == 0) throw std::underflow_error("Deque is empty");
+        return map[endBlock][endOffset - 1];
+    }
+
+    // Removes the last k elements and frees every block they emptied in one
+    // pass, instead of k separate pop_back calls.
+    void pop_back_n(int k) {
+        if (k < 0 || k > count) throw std::underflow_error("Deque has fewer elements than requested");
+        if (k == 0) return;
+        if constexpr (!std::is_trivially_destructible<T>::value) {
+            for (int i = count - k; i < count; ++i) {
+                slot(i)->~T();
+            }
+        }
+        count -= k;
+
+        int newEndBlock = startBlock;
+        if (count == 0) {
+            startOffset = endOffset = BLOCK_SIZE / 2;
+        } else {
+            int pos = startOffset + count;
+            newEndBlock = startBlock + (pos - 1) / BLOCK_SIZE;
+            endOffset = pos - (newEndBlock - startBlock) * BLOCK_SIZE;
+        }
+        for (int i = newEndBlock + 1; i <= endBlock; ++i) {
+            freeBlock(map[i]);
+            map[i] = nullptr;
+        }
+        endBlock = newEndBlock;
+    }
+
     int size() const {
         return count;
     }
@@ -155,6 +339,207 @@ public:
     }
 };
 
+// Growable contiguous array satisfying the same container interface as
+// Deque (push_back/emplace_back/pop_back/back/size). A pure LIFO never
+// touches a block boundary here; capacity only doubles on growth.
+template<typename T>
+class ContiguousArray {
+private:
+    T* data;
+    int count;
+    int cap;
+
+    // Builds the new element in the new buffer before touching the old one,
+    // since args may refer to an element being relocated (push_back(back())).
+    // If any constructor throws, the array is left as it was.
+    template<typename... Args>
+    T* growAndEmplace(Args&&... args) {
+        int newCap = cap == 0 ? 16 : cap * 2;
+        T* newData = static_cast<T*>(::operator new(sizeof(T) * newCap));
+        T* p = nullptr;
+        int moved = 0;
+        try {
+            p = ::new (static_cast<void*>(newData + count)) T(std::forward<Args>(args)...);
+            for (; moved < count; ++moved) {
+                ::new (static_cast<void*>(newData + moved)) T(std::move_if_noexcept(data[moved]));
+            }
+        } catch (...) {
+            while (moved > 0) newData[--moved].~T();
+            if (p) p->~T();
+            ::operator delete(newData);
+            throw;
+        }
+        for (int i = 0; i < count; ++i) {
+            data[i].~T();
+        }
+        ::operator delete(data);
+        data = newData;
+        cap = newCap;
+        return p;
+    }
+
+    void destroyAll() {
+        while (count > 0) {
+            data[--count].~T();
+        }
+    }
+
+public:
+    ContiguousArray() : data(nullptr), count(0), cap(0) {}
+
+    ContiguousArray(const ContiguousArray& other) : data(nullptr), count(0), cap(0) {
+        if (other.count > 0) {
+            data = static_cast<T*>(::operator new(sizeof(T) * other.count));
+            cap = other.count;
+            std::uninitialized_copy(other.data, other.data + other.count, data);
+            count = other.count;
+        }
+    }
+
+    ContiguousArray(ContiguousArray&& other) noexcept : data(other.data), count(other.count), cap(other.cap) {
+        other.data = nullptr;
+        other.count = 0;
+        other.cap = 0;
+    }
+
+    ContiguousArray& operator=(ContiguousArray other) noexcept {
+        std::swap(data, other.data);
+        std::swap(count, other.count);
+        std::swap(cap, other.cap);
+        return *this;
+    }
+
+    ~ContiguousArray() {
+        destroyAll();
+        ::operator delete(data);
+    }
+
+    template<typename... Args>
+    T& emplace_back(Args&&... args) {
+        T* p = count == cap ? growAndEmplace(std::forward<Args>(args)...)
+                            : ::new (static_cast<void*>(data + count)) T(std::forward<Args>(args)...);
+        count++;
+        return *p;
+    }
+
+    void push_back(const T& value) { emplace_back(value); }
+    void push_back(T&& value) { emplace_back(std::move(value)); }
+
+    void pop_back() {
+        if (count == 0) throw std::underflow_error("Array is empty");
+        data[--count].~T();
+    }
+
+    void pop_back_n(int k) {
+        if (k < 0 || k > count) throw std::underflow_error("Array has fewer elements than requested");
+        while (k-- > 0) {
+            data[--count].~T();
+        }
+    }
+
+    T& back() {
+        if (count == 0) throw std::underflow_error("Array is empty");
+        return data[count - 1];
+    }
+
+    const T& back() const {
+        if (count == 0) throw std::underflow_error("Array is empty");
+        return data[count - 1];
+    }
+
+    int size() const { return count; }
+    int capacity() const { return cap; }
+};
+
+// Fixed-capacity array stored inline; never allocates. Pushing past
+// Capacity throws std::overflow_error.
+template<typename T, int Capacity>
+class InlineArray {
+private:
+    alignas(T) unsigned char storage[sizeof(T) * Capacity];
+    int count;
+
+    T* slot(int i) { return reinterpret_cast<T*>(storage) + i; }
+    const T* slot(int i) const { return reinterpret_cast<const T*>(storage) + i; }
+
+public:
+    InlineArray() : count(0) {}
+
+    InlineArray(const InlineArray& other) : count(0) {
+        for (; count < other.count; ++count) {
+            ::new (static_cast<void*>(slot(count))) T(*other.slot(count));
+        }
+    }
+
+    InlineArray& operator=(const InlineArray& other) {
+        if (this == &other) return *this;
+        while (count > 0) pop_back();
+        for (; count < other.count; ++count) {
+            ::new (static_cast<void*>(slot(count))) T(*other.slot(count));
+        }
+        return *this;
+    }
+
+    ~InlineArray() {
+        while (count > 0) {
+            slot(--count)->~T();
+        }
+    }
+
+    template<typename... Args>
+    T& emplace_back(Args&&... args) {
+        if (count == Capacity) throw std::overflow_error("Inline array is full");
+        T* p = ::new (static_cast<void*>(slot(count))) T(std::forward<Args>(args)...);
+        count++;
+        return *p;
+    }
+
+    void push_back(const T& value) { emplace_back(value); }
+    void push_back(T&& value) { emplace_back(std::move(value)); }
+
+    void pop_back() {
+        if (count == 0) throw std::underflow_error("Array is empty");
+        slot(--count)->~T();
+    }
+
+    void pop_back_n(int k) {
+        if (k < 0 || k > count) throw std::underflow_error("Array has fewer elements than requested");
+        while (k-- > 0) {
+            slot(--count)->~T();
+        }
+    }
+
+    T& back() {
+        if (count == 0) throw std::underflow_error("Array is empty");
+        return *slot(count - 1);
+    }
+
+    const T& back() const {
+        if (count == 0) throw std::underflow_error("Array is empty");
+        return *slot(count - 1);
+    }
+
+    int size() const { return count; }
+    static int capacity() { return Capacity; }
+};
+
+template<typename C, typename = void>
+struct HasPopBackN : std::false_type {};
+
+template<typename C>
+struct HasPopBackN<C, std::void_t<decltype(std::declval<C&>().pop_back_n(0))>> : std::true_type {};
+
+// Removes the top k elements, in bulk when the container supports it.
+template<typename Container>
+void popBackN(Container& c, std::size_t k) {
+    if (k > static_cast<std::size_t>(c.size())) throw std::underflow_error("Stack has fewer elements than requested");
+    if constexpr (HasPopBackN<Container>::value) {
+        c.pop_back_n(static_cast<int>(k));
+    } else {
+        while (k-- > 0) c.pop_back();
+    }
+}
+
 template<typename T, typename Container = Deque<T>>
 class Stack {
 private:
@@ -162,6 +547,11 @@ private:
 
 public:
     void push(const T& value) { c.push_back(value); }
+    void push(T&& value) { c.push_back(std::move(value)); }
+
+    template<typename... Args>
+    T& emplace(Args&&... args) { return c.emplace_back(std::forward<Args>(args)...); }
+
     void pop() { 
         if (empty()) throw std::underflow_error("Stack is empty");
         c.pop_back(); 
@@ -174,11 +564,236 @@ public:
         if (empty()) throw std::underflow_error("Stack is empty");
         return c.back(); 
     }
+    // Moves the top element out; an empty optional means the stack was empty.
+    std::optional<T> try_pop() {
+        if (empty()) return std::nullopt;
+        std::optional<T> value(std::move(c.back()));
+        c.pop_back();
+        return value;
+    }
+    void pop_n(size_t k) { popBackN(c, k); }
+    bool empty() const { return c.size() == 0; }
+    size_t size() const { return c.size(); }
+};
+
+template<typename T>
+struct AggregateEntry {
+    T value;
+    T aggregate;
+
+    AggregateEntry(const T& value, const T& aggregate) : value(value), aggregate(aggregate) {}
+};
+
+template<typename T>
+struct MinOf {
+    const T& operator()(const T& a, const T& b) const { return b < a ? b : a; }
+};
+
+template<typename T>
+struct MaxOf {
+    const T& operator()(const T& a, const T& b) const { return a < b ? b : a; }
+};
+
+// Stack that keeps an associative aggregate (min, max, sum, gcd, ...) of
+// everything it holds. Each entry records the aggregate of itself and all
+// entries below it, so aggregate(), push and pop are all O(1). Any
+// container usable by Stack works; InlineArray gives a never-allocating,
+// fixed-capacity variant.
+template<typename T, typename Op, typename Container = Deque<AggregateEntry<T>>>
+class AggregateStack {
+private:
+    Container c;
+    Op op;
+
+public:
+    explicit AggregateStack(Op op = Op()) : op(op) {}
+
+    void push(const T& value) {
+        if (c.size() == 0) {
+            c.emplace_back(value, value);
+        } else {
+            c.emplace_back(value, op(c.back().aggregate, value));
+        }
+    }
+
+    template<typename... Args>
+    void emplace(Args&&... args) {
+        push(T(std::forward<Args>(args)...));
+    }
+
+    void pop() {
+        if (empty()) throw std::underflow_error("Stack is empty");
+        c.pop_back();
+    }
+
+    void pop_n(size_t k) { popBackN(c, k); }
+
+    const T& top() const {
+        if (empty()) throw std::underflow_error("Stack is empty");
+        return c.back().value;
+    }
+
+    const T& aggregate() const {
+        if (empty()) throw std::underflow_error("Stack is empty");
+        return c.back().aggregate;
+    }
+
+    const T& min() const {
+        static_assert(std::is_same<Op, MinOf<T>>::value, "min() is only available on MinStack");
+        return aggregate();
+    }
+
+    const T& max() const {
+        static_assert(std::is_same<Op, MaxOf<T>>::value, "max() is only available on MaxStack");
+        return aggregate();
+    }
+
     bool empty() const { return c.size() == 0; }
     size_t size() const { return c.size(); }
 };
 
-int main() {
+template<typename T, typename Container = Deque<AggregateEntry<T>>>
+using MinStack = AggregateStack<T, MinOf<T>, Container>;
+
+template<typename T, typename Container = Deque<AggregateEntry<T>>>
+using MaxStack = AggregateStack<T, MaxOf<T>, Container>;
+
+// Pushes depth elements then pops them all, rounds times over.
+template<typename StackType, typename Make>
+double benchmarkBackend(int depth, int rounds, Make make) {
+    StackType s;
+    double ns = timeNs([&] {
+        for (int round = 0; round < rounds; ++round) {
+            for (int i = 0; i < depth; ++i) s.emplace(make(i));
+            for (int i = 0; i < depth; ++i) benchmarkSink = benchmarkSink + (s.try_pop() ? 1 : 0);
+        }
+    });
+    return ns / (2.0 * depth * rounds);
+}
+
+template<typename StackType, typename Make>
+void reportBackend(const char* name, int n, Make make) {
+    std::cout << "  " << name << ": deep " << benchmarkBackend<StackType>(n, 1, make)
+              << " ns/op, shallow " << benchmarkBackend<StackType>(500, n / 500, make) << " ns/op\n";
+}
+
+// Unwinding k frames at a time: bulk pop_n against k single pops.
+void benchmarkUnwind(int n, int k) {
+    double single = timeNs([&] {
+        Stack<std::string> s;
+        for (int i = 0; i < n; ++i) s.emplace(24, 'x');
+        while (!s.empty()) {
+            for (int i = 0; i < k && !s.empty(); ++i) s.pop();
+        }
+    });
+    double bulk = timeNs([&] {
+        Stack<std::string> s;
+        for (int i = 0; i < n; ++i) s.emplace(24, 'x');
+        while (!s.empty()) s.pop_n(std::min<size_t>(k, s.size()));
+    });
+    std::cout << "  unwind by " << k << ": single pops " << single / 1e6 << " ms, pop_n " << bulk / 1e6 << " ms\n";
+}
+
+void benchmarkAggregates(int n) {
+    std::mt19937 rng(7);
+    std::vector<int> values(n);
+    for (int& v : values) v = static_cast<int>(rng());
+
+    long long sink = 0;
+    double minNs = timeNs([&] {
+        MinStack<int> s;
+        for (int i = 0; i < n; ++i) {
+            s.push(values[i]);
+            sink += s.min();
+            if (i % 3 == 0) s.pop();
+        }
+    });
+    double fixedNs = timeNs([&] {
+        MaxStack<int, InlineArray<AggregateEntry<int>, 1024>> s;
+        for (int i = 0; i < n; ++i) {
+            if (s.size() == 1024) s.pop_n(512);
+            s.push(values[i]);
+            sink += s.max();
+        }
+    });
+    benchmarkSink = sink;
+    std::cout << "  MinStack (Deque) push+min: " << minNs / n << " ns/op\n";
+    std::cout << "  MaxStack (InlineArray<1024>) push+max: " << fixedNs / n << " ns/op\n";
+}
+
+void runBenchmarks() {
+    const int n = 10000000;
+    auto makeInt = [](int i) { return i; };
+    auto makeString = [](int i) { return std::string(24, static_cast<char>('a' + i % 26)); };
+
+    std::cout << "Stack<int>, deep = one fill/drain of " << n << ", shallow = 500-deep sawtooth:\n";
+    reportBackend<Stack<int>>("Deque", n, makeInt);
+    reportBackend<Stack<int, ContiguousArray<int>>>("ContiguousArray", n, makeInt);
+    reportBackend<Stack<int, std::vector<int>>>("std::vector", n, makeInt);
+    std::cout << "  InlineArray<512>: shallow "
+              << benchmarkBackend<Stack<int, InlineArray<int, 512>>>(500, n / 500, makeInt) << " ns/op\n";
+
+    std::cout << "Bulk unwind of " << n / 10 << " strings:\n";
+    benchmarkUnwind(n / 10, 1000);
+    std::cout << "Aggregate stacks, " << n << " pushes:\n";
+    benchmarkAggregates(n);
+
+    std::cout << "Stack<std::string>, " << n / 10 << " elements:\n";
+    reportBackend<Stack<std::string>>("Deque", n / 10, makeString);
+    reportBackend<Stack<std::string, ContiguousArray<std::string>>>("ContiguousArray", n / 10, makeString);
+    std::cout << "  InlineArray<512>: shallow "
+              << benchmarkBackend<Stack<std::string, InlineArray<std::string, 512>>>(500, n / 5000, makeString)
+              << " ns/op\n";
+}
+
+enum Opcode {
+    OP_PUSH,
+    OP_POP,
+    OP_TOP,
+    OP_SIZE,
+    OP_EMPTY,
+    OP_EXIT,
+    OP_COUNT
+};
+
+// Indexed by Opcode.
+static const CommandInfo COMMANDS[OP_COUNT] = {
+    {"push", true},
+    {"pop", false},
+    {"top", false},
+    {"size", false},
+    {"empty", false},
+    {"exit", false},
+};
+
+int runBatch(const std::string& path) {
+    Stack<int> stack;
+    return runReplay(path, COMMANDS, OP_COUNT, OP_EXIT, "Unknown command. Try again.", [&](int op, int value, OutputBuffer& out) {
+        switch (op) {
+        case OP_PUSH: stack.push(value); out.appendLine("Pushed ", value); break;
+        case OP_POP: out.appendLine("Popped ", stack.top()); stack.pop(); break;
+        case OP_TOP: out.appendLine("Top: ", stack.top()); break;
+        case OP_SIZE: out.appendLine("Size: ", static_cast<long long>(stack.size())); break;
+        case OP_EMPTY: out.append(stack.empty() ? "Stack is empty\n" : "Stack is not empty\n"); break;
+        default: break;
+        }
+    });
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "--bench") {
+        runBenchmarks();
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--batch") {
+        try {
+            return runBatch(argc > 2 ? argv[2] : "-");
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+    }
+
     Stack<int> stack;
     std::string command;
     int value;
@@ -1,172 +1,3024 @@
 #include <iostream>
 #include <memory>
 #include <stdexcept>
+#include <algorithm>
 #include <limits>
 #include <string>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <exception>
+#include <functional>
+#include <type_traits>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <fstream>
+#include <map>
+#include <set>
+#include <array>
+#include <cmath>
+#include <random>
+#include <charconv>
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bench.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(MATRIX_NO_SIMD)
+#define MATRIX_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+// Matrices whose elements fit in this many bytes keep them inline, so small
+// temporaries never touch the heap. Override with -DMATRIX_INLINE_BYTES=n.
+#ifndef MATRIX_INLINE_BYTES
+#define MATRIX_INLINE_BYTES 256
+#endif
+
+// Tag for storage whose every element is about to be overwritten.
+struct NoInit {};
+
+template <typename T, size_t N, bool Inline = N * sizeof(T) <= MATRIX_INLINE_BYTES>
+class MatrixStorage {
+public:
+    MatrixStorage() : elements{} {}
+    explicit MatrixStorage(NoInit) {}
+
+    void allocate() {}
+
+    T* get() { return elements; }
+    const T* get() const { return elements; }
+    T& operator[](size_t i) { return elements[i]; }
+    const T& operator[](size_t i) const { return elements[i]; }
+
+private:
+    T elements[N];
+};
+
+// Above the threshold the elements live on the heap and moves steal them.
+template <typename T, size_t N>
+class MatrixStorage<T, N, false> {
+public:
+    MatrixStorage() : elements(std::make_unique<T[]>(N)) {}
+    explicit MatrixStorage(NoInit) : elements(new T[N]) {}
+
+    MatrixStorage(const MatrixStorage& other) : elements(std::make_unique<T[]>(N)) {
+        std::copy(other.elements.get(), other.elements.get() + N, elements.get());
+    }
+
+    MatrixStorage(MatrixStorage&& other) noexcept = default;
+
+    MatrixStorage& operator=(const MatrixStorage& other) {
+        if (this != &other) {
+            if (!elements) elements = std::make_unique<T[]>(N);
+            std::copy(other.elements.get(), other.elements.get() + N, elements.get());
+        }
+        return *this;
+    }
+
+    MatrixStorage& operator=(MatrixStorage&& other) noexcept = default;
+
+    // A moved-from matrix has no buffer until it is assigned to again.
+    void allocate() {
+        if (!elements) elements.reset(new T[N]);
+    }
+
+    T* get() { return elements.get(); }
+    const T* get() const { return elements.get(); }
+    T& operator[](size_t i) { return elements[i]; }
+    const T& operator[](size_t i) const { return elements[i]; }
+
+private:
+    std::unique_ptr<T[]> elements;
+};
+
+// Operations touching at least this many elements (or multiply-adds) are
+// split across the thread pool. Override with -DMATRIX_PARALLEL_WORK=n.
+#ifndef MATRIX_PARALLEL_WORK
+#define MATRIX_PARALLEL_WORK (1 << 17)
+#endif
+
+// Fixed set of workers that split a row range with the calling thread. One
+// job runs at a time; a job submitted while another is running, or from
+// inside one, runs serially on the caller instead.
+class MatrixThreadPool {
+public:
+    static MatrixThreadPool& instance() {
+        static MatrixThreadPool pool;
+        return pool;
+    }
+
+    ~MatrixThreadPool() {
+        stop();
+    }
+
+    // Total threads used per job, the caller included.
+    unsigned threads() const {
+        return static_cast<unsigned>(workers.size()) + 1;
+    }
+
+    void set_threads(unsigned count) {
+        std::lock_guard<std::mutex> job(jobMutex);
+        stop();
+        start(count ? count : 1);
+    }
+
+    // Calls body(begin, end) on one contiguous chunk of [0, n) per thread.
+    // Returns false, without calling body, if the pool is busy. Every chunk
+    // has finished when run returns or throws; if any chunk threw, the
+    // caller's exception, else the first worker's, is rethrown.
+    template <typename F>
+    bool run(size_t n, F& body) {
+        if (insideJob) return false;
+        std::unique_lock<std::mutex> job(jobMutex, std::try_to_lock);
+        if (!job.owns_lock()) return false;
+
+        size_t chunks = threads();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task = [](void* context, size_t begin, size_t end) { (*static_cast<F*>(context))(begin, end); };
+            context = &body;
+            total = n;
+            pending = workers.size();
+            error = nullptr;
+            ++generation;
+        }
+        wake.notify_all();
+
+        {
+            // Workers may still be using body through context, so even a
+            // throwing body must wait for them before it unwinds.
+            struct JobGuard {
+                MatrixThreadPool& pool;
+                ~JobGuard() {
+                    insideJob = false;
+                    std::unique_lock<std::mutex> lock(pool.mutex);
+                    pool.finished.wait(lock, [this] { return pool.pending == 0; });
+                }
+            } guard{*this};
+            insideJob = true;
+            body(0, n / chunks);
+        }
+
+        std::exception_ptr failure;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::swap(failure, error);
+        }
+        if (failure) std::rethrow_exception(failure);
+        return true;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex jobMutex;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    void (*task)(void*, size_t, size_t) = nullptr;
+    void* context = nullptr;
+    size_t total = 0;
+    size_t pending = 0;
+    size_t generation = 0;
+    std::exception_ptr error;
+    bool stopping = false;
+    static thread_local bool insideJob;
+
+    MatrixThreadPool() {
+        start(std::max(1u, std::thread::hardware_concurrency()));
+    }
+
+    void start(unsigned count) {
+        stopping = false;
+        generation = 0;
+        for (unsigned i = 1; i < count; ++i) {
+            workers.emplace_back([this, i] { work(i); });
+        }
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+    }
+
+    void work(size_t chunk) {
+        size_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            size_t chunks = workers.size() + 1;
+            size_t begin = total * chunk / chunks;
+            size_t end = total * (chunk + 1) / chunks;
+            lock.unlock();
+            std::exception_ptr failure;
+            insideJob = true;
+            try {
+                task(context, begin, end);
+            } catch (...) {
+                failure = std::current_exception();
+            }
+            insideJob = false;
+            lock.lock();
+            if (failure && !error) error = failure;
+            if (--pending == 0) finished.notify_one();
+        }
+    }
+};
+
+thread_local bool MatrixThreadPool::insideJob = false;
+
+// Runs body(begin, end) over the rows [0, n), in parallel when work justifies
+// waking the pool.
+template <typename F>
+void parallelFor(size_t n, size_t work, F body) {
+    if (work < MATRIX_PARALLEL_WORK || n < 2 || !MatrixThreadPool::instance().run(n, body)) {
+        body(0, n);
+    }
+}
+
+// operator() checks its indices only when MATRIX_CHECKED is non-zero, which
+// by default follows assert(): on unless NDEBUG is defined. at() always
+// checks; data() and row() give unchecked pointers for tight loops.
+#ifndef MATRIX_CHECKED
+#ifdef NDEBUG
+#define MATRIX_CHECKED 0
+#else
+#define MATRIX_CHECKED 1
+#endif
+#endif
+
+inline void checkIndices(size_t row, size_t col, size_t rows, size_t cols) {
+    if (row >= rows || col >= cols) {
+        throw std::out_of_range("Matrix indices out of range");
+    }
+}
+
+// Multiply kernels work on raw row-major buffers with explicit leading
+// dimensions, so they do not depend on how a matrix stores its elements.
+// Micro-kernels compute an MR x NR tile of C from packed slivers of A (MR
+// values per k step) and B (NR values per k step), either storing the tile
+// or adding it to C.
+template <typename T>
+struct PortableKernel {
+    static constexpr size_t MR = 4;
+    static constexpr size_t NR = 4;
+
+    static void run(size_t kc, const T* a, const T* b, T* c, size_t ldc, bool accumulate) {
+        T acc[MR][NR] = {};
+        for (size_t p = 0; p < kc; ++p) {
+            for (size_t i = 0; i < MR; ++i) {
+                for (size_t j = 0; j < NR; ++j) {
+                    acc[i][j] += a[p * MR + i] * b[p * NR + j];
+                }
+            }
+        }
+        for (size_t i = 0; i < MR; ++i) {
+            for (size_t j = 0; j < NR; ++j) {
+                c[i * ldc + j] = accumulate ? c[i * ldc + j] + acc[i][j] : acc[i][j];
+            }
+        }
+    }
+};
+
+#ifdef MATRIX_X86_SIMD
+// 6 rows x 2 vectors of accumulators, leaving registers for the B loads and
+// the A broadcast.
+struct Avx2Kernel {
+    static constexpr size_t MR = 6;
+    static constexpr size_t NR = 8;
+
+    __attribute__((target("avx2,fma")))
+    static void run(size_t kc, const double* a, const double* b, double* c, size_t ldc, bool accumulate) {
+        __m256d acc[MR][2];
+#pragma GCC unroll 6
+        for (size_t i = 0; i < MR; ++i) {
+            acc[i][0] = acc[i][1] = _mm256_setzero_pd();
+        }
+        for (size_t p = 0; p < kc; ++p) {
+            __m256d b0 = _mm256_loadu_pd(b + p * NR);
+            __m256d b1 = _mm256_loadu_pd(b + p * NR + 4);
+#pragma GCC unroll 6
+            for (size_t i = 0; i < MR; ++i) {
+                __m256d ai = _mm256_broadcast_sd(a + p * MR + i);
+                acc[i][0] = _mm256_fmadd_pd(ai, b0, acc[i][0]);
+                acc[i][1] = _mm256_fmadd_pd(ai, b1, acc[i][1]);
+            }
+        }
+#pragma GCC unroll 6
+        for (size_t i = 0; i < MR; ++i) {
+            double* row = c + i * ldc;
+            if (accumulate) {
+                acc[i][0] = _mm256_add_pd(acc[i][0], _mm256_loadu_pd(row));
+                acc[i][1] = _mm256_add_pd(acc[i][1], _mm256_loadu_pd(row + 4));
+            }
+            _mm256_storeu_pd(row, acc[i][0]);
+            _mm256_storeu_pd(row + 4, acc[i][1]);
+        }
+    }
+};
+
+struct Avx512Kernel {
+    static constexpr size_t MR = 6;
+    static constexpr size_t NR = 16;
+
+    __attribute__((target("avx512f")))
+    static void run(size_t kc, const double* a, const double* b, double* c, size_t ldc, bool accumulate) {
+        __m512d acc[MR][2];
+#pragma GCC unroll 6
+        for (size_t i = 0; i < MR; ++i) {
+            acc[i][0] = acc[i][1] = _mm512_setzero_pd();
+        }
+        for (size_t p = 0; p < kc; ++p) {
+            __m512d b0 = _mm512_loadu_pd(b + p * NR);
+            __m512d b1 = _mm512_loadu_pd(b + p * NR + 8);
+#pragma GCC unroll 6
+            for (size_t i = 0; i < MR; ++i) {
+                __m512d ai = _mm512_set1_pd(a[p * MR + i]);
+                acc[i][0] = _mm512_fmadd_pd(ai, b0, acc[i][0]);
+                acc[i][1] = _mm512_fmadd_pd(ai, b1, acc[i][1]);
+            }
+        }
+#pragma GCC unroll 6
+        for (size_t i = 0; i < MR; ++i) {
+            double* row = c + i * ldc;
+            if (accumulate) {
+                acc[i][0] = _mm512_add_pd(acc[i][0], _mm512_loadu_pd(row));
+                acc[i][1] = _mm512_add_pd(acc[i][1], _mm512_loadu_pd(row + 8));
+            }
+            _mm512_storeu_pd(row, acc[i][0]);
+            _mm512_storeu_pd(row + 8, acc[i][1]);
+        }
+    }
+};
+
+// The float kernels use the same register layout with twice the lanes.
+struct Avx2FloatKernel {
+    static constexpr size_t MR = 6;
+    static constexpr size_t NR = 16;
+
+    __attribute__((target("avx2,fma")))
+    static void run(size_t kc, const float* a, const float* b, float* c, size_t ldc, bool accumulate) {
+        __m256 acc[MR][2];
+#pragma GCC unroll 6
+        for (size_t i = 0; i < MR; ++i) {
+            acc[i][0] = acc[i][1] = _mm256_setzero_ps();
+        }
+        for (size_t p = 0; p < kc; ++p) {
+            __m256 b0 = _mm256_loadu_ps(b + p * NR);
+            __m256 b1 = _mm256_loadu_ps(b + p * NR + 8);
+#pragma GCC unroll 6
+            for (size_t i = 0; i < MR; ++i) {
+                __m256 ai = _mm256_broadcast_ss(a + p * MR + i);
+                acc[i][0] = _mm256_fmadd_ps(ai, b0, acc[i][0]);
+                acc[i][1] = _mm256_fmadd_ps(ai, b1, acc[i][1]);
+            }
+        }
+#pragma GCC unroll 6
+        for (size_t i = 0; i < MR; ++i) {
+            float* row = c + i * ldc;
+            if (accumulate) {
+                acc[i][0] = _mm256_add_ps(acc[i][0], _mm256_loadu_ps(row));
+                acc[i][1] = _mm256_add_ps(acc[i][1], _mm256_loadu_ps(row + 8));
+            }
+            _mm256_storeu_ps(row, acc[i][0]);
+            _mm256_storeu_ps(row + 8, acc[i][1]);
+        }
+    }
+};
+
+struct Avx512FloatKernel {
+    static constexpr size_t MR = 6;
+    static constexpr size_t NR = 32;
+
+    __attribute__((target("avx512f")))
+    static void run(size_t kc, const float* a, const float* b, float* c, size_t ldc, bool accumulate) {
+        __m512 acc[MR][2];
+#pragma GCC unroll 6
+        for (size_t i = 0; i < MR; ++i) {
+            acc[i][0] = acc[i][1] = _mm512_setzero_ps();
+        }
+        for (size_t p = 0; p < kc; ++p) {
+            __m512 b0 = _mm512_loadu_ps(b + p * NR);
+            __m512 b1 = _mm512_loadu_ps(b + p * NR + 16);
+#pragma GCC unroll 6
+            for (size_t i = 0; i < MR; ++i) {
+                __m512 ai = _mm512_set1_ps(a[p * MR + i]);
+                acc[i][0] = _mm512_fmadd_ps(ai, b0, acc[i][0]);
+                acc[i][1] = _mm512_fmadd_ps(ai, b1, acc[i][1]);
+            }
+        }
+#pragma GCC unroll 6
+        for (size_t i = 0; i < MR; ++i) {
+            float* row = c + i * ldc;
+            if (accumulate) {
+                acc[i][0] = _mm512_add_ps(acc[i][0], _mm512_loadu_ps(row));
+                acc[i][1] = _mm512_add_ps(acc[i][1], _mm512_loadu_ps(row + 16));
+            }
+            _mm512_storeu_ps(row, acc[i][0]);
+            _mm512_storeu_ps(row + 16, acc[i][1]);
+        }
+    }
+};
+#endif
+
+// Copies an mc x kc block of A into MR-row slivers, zero-padding the last.
+template <size_t MR, typename T>
+void packA(size_t mc, size_t kc, const T* a, size_t lda, T* dst) {
+    for (size_t ir = 0; ir < mc; ir += MR) {
+        for (size_t p = 0; p < kc; ++p) {
+            for (size_t i = 0; i < MR; ++i) {
+                *dst++ = ir + i < mc ? a[(ir + i) * lda + p] : T{};
+            }
+        }
+    }
+}
+
+// Copies a kc x nc block of B into NR-column slivers, zero-padding the last.
+template <size_t NR, typename T>
+void packB(size_t kc, size_t nc, const T* b, size_t ldb, T* dst) {
+    for (size_t jr = 0; jr < nc; jr += NR) {
+        for (size_t p = 0; p < kc; ++p) {
+            for (size_t j = 0; j < NR; ++j) {
+                *dst++ = jr + j < nc ? b[p * ldb + jr + j] : T{};
+            }
+        }
+    }
+}
+
+// C = A * B in three levels of blocking: an NC-wide panel of B and an
+// MC x KC block of A are packed so the micro-kernel streams both from cache.
+template <typename Kernel, typename T>
+void gemmBlocked(size_t m, size_t n, size_t k, const T* a, size_t lda, const T* b, size_t ldb, T* c, size_t ldc) {
+    constexpr size_t MR = Kernel::MR;
+    constexpr size_t NR = Kernel::NR;
+    constexpr size_t MC = 16 * MR;
+    constexpr size_t KC = 256;
+    constexpr size_t NC = 128 * NR;
+
+    // Sized for this product, not the largest block, so small products keep
+    // small buffers; they only grow when a bigger product needs more.
+    const size_t kcMax = std::min(KC, k);
+    const size_t packedASize = (std::min(MC, m) + MR - 1) / MR * MR * kcMax;
+    const size_t packedBSize = (std::min(NC, n) + NR - 1) / NR * NR * kcMax;
+    thread_local std::vector<T> packedA, packedB;
+    if (packedA.size() < packedASize) packedA.resize(packedASize);
+    if (packedB.size() < packedBSize) packedB.resize(packedBSize);
+
+    for (size_t jc = 0; jc < n; jc += NC) {
+        size_t nc = std::min(NC, n - jc);
+        for (size_t pc = 0; pc < k; pc += KC) {
+            size_t kc = std::min(KC, k - pc);
+            bool accumulate = pc > 0;
+            packB<NR>(kc, nc, b + pc * ldb + jc, ldb, packedB.data());
+            for (size_t ic = 0; ic < m; ic += MC) {
+                size_t mc = std::min(MC, m - ic);
+                packA<MR>(mc, kc, a + ic * lda + pc, lda, packedA.data());
+                for (size_t jr = 0; jr < nc; jr += NR) {
+                    for (size_t ir = 0; ir < mc; ir += MR) {
+                        const T* ap = packedA.data() + ir * kc;
+                        const T* bp = packedB.data() + jr * kc;
+                        T* cp = c + (ic + ir) * ldc + jc + jr;
+                        size_t mr = std::min(MR, mc - ir);
+                        size_t nr = std::min(NR, nc - jr);
+                        if (mr == MR && nr == NR) {
+                            Kernel::run(kc, ap, bp, cp, ldc, accumulate);
+                            continue;
+                        }
+                        T tile[MR * NR];
+                        Kernel::run(kc, ap, bp, tile, NR, false);
+                        for (size_t i = 0; i < mr; ++i) {
+                            for (size_t j = 0; j < nr; ++j) {
+                                cp[i * ldc + j] = accumulate ? cp[i * ldc + j] + tile[i * NR + j] : tile[i * NR + j];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Below this many multiply-adds packing costs more than it saves.
+constexpr size_t GEMM_SMALL_WORK = 8 * 8 * 8;
+
+template <typename T>
+void gemmSmall(size_t m, size_t n, size_t k, const T* a, size_t lda, const T* b, size_t ldb, T* c, size_t ldc) {
+    for (size_t i = 0; i < m; ++i) {
+        T* row = c + i * ldc;
+        std::fill(row, row + n, T{});
+        for (size_t p = 0; p < k; ++p) {
+            T aip = a[i * lda + p];
+            const T* brow = b + p * ldb;
+            for (size_t j = 0; j < n; ++j) {
+                row[j] += aip * brow[j];
+            }
+        }
+    }
+}
+
+enum class GemmIsa { Portable, Avx2, Avx512 };
+
+inline GemmIsa detectGemmIsa() {
+#ifdef MATRIX_X86_SIMD
+    static const GemmIsa isa = __builtin_cpu_supports("avx512f") ? GemmIsa::Avx512
+        : __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") ? GemmIsa::Avx2
+        : GemmIsa::Portable;
+    return isa;
+#else
+    return GemmIsa::Portable;
+#endif
+}
+
+inline const char* gemmIsaName(GemmIsa isa) {
+    switch (isa) {
+        case GemmIsa::Avx512: return "AVX-512";
+        case GemmIsa::Avx2: return "AVX2";
+        case GemmIsa::Portable: break;
+    }
+    return "portable";
+}
+
+// Single-threaded C = A * B. double and float pick the widest SIMD kernel
+// the CPU supports at run time; other element types use the portable
+// kernel.
+template <typename T>
+void gemmSerial(size_t m, size_t n, size_t k, const T* a, size_t lda, const T* b, size_t ldb, T* c, size_t ldc) {
+    if (m * n * k <= GEMM_SMALL_WORK) {
+        gemmSmall(m, n, k, a, lda, b, ldb, c, ldc);
+        return;
+    }
+#ifdef MATRIX_X86_SIMD
+    if constexpr (std::is_same<T, double>::value) {
+        switch (detectGemmIsa()) {
+            case GemmIsa::Avx512:
+                gemmBlocked<Avx512Kernel>(m, n, k, a, lda, b, ldb, c, ldc);
+                return;
+            case GemmIsa::Avx2:
+                gemmBlocked<Avx2Kernel>(m, n, k, a, lda, b, ldb, c, ldc);
+                return;
+            case GemmIsa::Portable:
+                break;
+        }
+    } else if constexpr (std::is_same<T, float>::value) {
+        switch (detectGemmIsa()) {
+            case GemmIsa::Avx512:
+                gemmBlocked<Avx512FloatKernel>(m, n, k, a, lda, b, ldb, c, ldc);
+                return;
+            case GemmIsa::Avx2:
+                gemmBlocked<Avx2FloatKernel>(m, n, k, a, lda, b, ldb, c, ldc);
+                return;
+            case GemmIsa::Portable:
+                break;
+        }
+    }
+#endif
+    gemmBlocked<PortableKernel<T>>(m, n, k, a, lda, b, ldb, c, ldc);
+}
+
+// C (m x n) = A (m x k) * B (k x n), each thread producing a band of rows.
+template <typename T>
+void gemm(size_t m, size_t n, size_t k, const T* a, size_t lda, const T* b, size_t ldb, T* c, size_t ldc) {
+    parallelFor(m, m * n * k, [=](size_t begin, size_t end) {
+        gemmSerial(end - begin, n, k, a + begin * lda, lda, b, ldb, c + begin * ldc, ldc);
+    });
+}
+
+// C = op(A, B) element by element.
+template <typename T, typename Op>
+void elementwise(size_t rows, size_t cols, const T* a, size_t lda, const T* b, size_t ldb, T* c, size_t ldc, Op op) {
+    parallelFor(rows, rows * cols, [=](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            for (size_t j = 0; j < cols; ++j) {
+                c[i * ldc + j] = op(a[i * lda + j], b[i * ldb + j]);
+            }
+        }
+    });
+}
+
+// C = op(A) element by element.
+template <typename T, typename Op>
+void elementwise(size_t rows, size_t cols, const T* a, size_t lda, T* c, size_t ldc, Op op) {
+    parallelFor(rows, rows * cols, [=](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            for (size_t j = 0; j < cols; ++j) {
+                c[i * ldc + j] = op(a[i * lda + j]);
+            }
+        }
+    });
+}
+
+// Side of the square tiles the transposes bottom out in: a source and a
+// destination tile of doubles together fit in L1.
+constexpr size_t TRANSPOSE_TILE = 32;
+
+// Cache-oblivious transpose: halves the longer side until the block is a
+// single tile, so every level of the cache hierarchy sees blocks that fit.
+template <typename T>
+void transposeBlock(size_t rows, size_t cols, const T* src, size_t lds, T* dst, size_t ldd) {
+    if (rows <= TRANSPOSE_TILE && cols <= TRANSPOSE_TILE) {
+        // Within a tile both sides are in L1; writing dst rows in order
+        // keeps the stores sequential.
+        for (size_t j = 0; j < cols; ++j) {
+            for (size_t i = 0; i < rows; ++i) {
+                dst[j * ldd + i] = src[i * lds + j];
+            }
+        }
+    } else if (rows >= cols) {
+        size_t half = rows / 2;
+        transposeBlock(half, cols, src, lds, dst, ldd);
+        transposeBlock(rows - half, cols, src + half * lds, lds, dst + half, ldd);
+    } else {
+        size_t half = cols / 2;
+        transposeBlock(rows, half, src, lds, dst, ldd);
+        transposeBlock(rows, cols - half, src + half, lds, dst + half * ldd, ldd);
+    }
+}
+
+// dst (cols x rows) = transpose of src (rows x cols).
+template <typename T>
+void transposeKernel(size_t rows, size_t cols, const T* src, size_t lds, T* dst, size_t ldd) {
+    parallelFor(rows, rows * cols, [=](size_t begin, size_t end) {
+        transposeBlock(end - begin, cols, src + begin * lds, lds, dst + begin, ldd);
+    });
+}
+
+// Transposes the n x n matrix a in place by swapping each tile above the
+// diagonal with its mirror. A thread owns a band of tile rows, so the tile
+// pairs it swaps never overlap another thread's.
+template <typename T>
+void transposeSquareInPlace(size_t n, T* a, size_t lda) {
+    size_t tiles = (n + TRANSPOSE_TILE - 1) / TRANSPOSE_TILE;
+    parallelFor(tiles, n * n, [=](size_t begin, size_t end) {
+        for (size_t bi = begin; bi < end; ++bi) {
+            size_t i0 = bi * TRANSPOSE_TILE;
+            size_t i1 = std::min(n, i0 + TRANSPOSE_TILE);
+            for (size_t i = i0; i < i1; ++i) {
+                for (size_t j = i + 1; j < i1; ++j) {
+                    std::swap(a[i * lda + j], a[j * lda + i]);
+                }
+            }
+            for (size_t j0 = i1; j0 < n; j0 += TRANSPOSE_TILE) {
+                size_t j1 = std::min(n, j0 + TRANSPOSE_TILE);
+                for (size_t i = i0; i < i1; ++i) {
+                    for (size_t j = j0; j < j1; ++j) {
+                        std::swap(a[i * lda + j], a[j * lda + i]);
+                    }
+                }
+            }
+        }
+    });
+}
+
+// Base of every matrix expression. Nodes expose their shape as rows/cols,
+// their element type as value_type and an unchecked element(r, c); nodes
+// whose elements follow row-major order (linear) also expose element(i), so
+// assigning them is a single flat loop.
+template <typename E>
+struct MatrixExpr {
+    const E& self() const { return static_cast<const E&>(*this); }
+};
+
+template <size_t Rows, size_t Cols, typename T>
+class Matrix;
+
+// Non-owning window onto row-major elements: rows x cols, with stride
+// elements between the starts of consecutive rows. Sub-blocks of a view are
+// views into the same elements, so taking one never copies.
+template <typename T>
+class MatrixView {
+public:
+    MatrixView(T* data, size_t rows, size_t cols, size_t stride)
+        : elements(data), numRows(rows), numCols(cols), rowStride(stride) {}
+
+    operator MatrixView<const T>() const {
+        return MatrixView<const T>(elements, numRows, numCols, rowStride);
+    }
+
+    T& operator()(size_t row, size_t col) const {
+        if (MATRIX_CHECKED) checkIndices(row, col, numRows, numCols);
+        return elements[row * rowStride + col];
+    }
+
+    T& at(size_t row, size_t col) const {
+        checkIndices(row, col, numRows, numCols);
+        return elements[row * rowStride + col];
+    }
+
+    T* row(size_t i) const { return elements + i * rowStride; }
+
+    MatrixView block(size_t row, size_t col, size_t rows, size_t cols) const {
+        if (row > numRows || col > numCols || rows > numRows - row || cols > numCols - col) {
+            throw std::out_of_range("Matrix block out of range");
+        }
+        return MatrixView(elements + row * rowStride + col, rows, cols, rowStride);
+    }
+
+    MatrixView<const T> view() const { return *this; }
+
+    T* data() const { return elements; }
+    size_t rows() const { return numRows; }
+    size_t cols() const { return numCols; }
+    size_t stride() const { return rowStride; }
+
+private:
+    T* elements;
+    size_t numRows;
+    size_t numCols;
+    size_t rowStride;
+};
+
+// Matrices are held by reference and intermediate nodes by value, so an
+// expression stays valid as long as the matrices it names.
+template <typename E>
+struct ExprOperand {
+    using type = const E;
+};
+
+template <size_t Rows, size_t Cols, typename T>
+struct ExprOperand<Matrix<Rows, Cols, T>> {
+    using type = const Matrix<Rows, Cols, T>&;
+};
+
+template <typename L, typename R, typename Op>
+class MatrixBinary : public MatrixExpr<MatrixBinary<L, R, Op>> {
+public:
+    static_assert(L::rows == R::rows && L::cols == R::cols, "Matrix dimensions must match");
+    static_assert(std::is_same<typename L::value_type, typename R::value_type>::value,
+                  "Matrix element types must match");
+
+    using value_type = typename L::value_type;
+    static constexpr size_t rows = L::rows;
+    static constexpr size_t cols = L::cols;
+    static constexpr bool linear = L::linear && R::linear;
+
+    MatrixBinary(const L& lhs, const R& rhs) : lhs(lhs), rhs(rhs) {}
+
+    value_type element(size_t i) const { return Op()(lhs.element(i), rhs.element(i)); }
+    value_type element(size_t row, size_t col) const { return Op()(lhs.element(row, col), rhs.element(row, col)); }
+    bool aliases(const void* p) const { return lhs.aliases(p) || rhs.aliases(p); }
+
+private:
+    typename ExprOperand<L>::type lhs;
+    typename ExprOperand<R>::type rhs;
+};
+
+template <typename E>
+class MatrixScaled : public MatrixExpr<MatrixScaled<E>> {
+public:
+    using value_type = typename E::value_type;
+    static constexpr size_t rows = E::rows;
+    static constexpr size_t cols = E::cols;
+    static constexpr bool linear = E::linear;
+
+    MatrixScaled(const E& expr, value_type factor) : expr(expr), factor(factor) {}
+
+    value_type element(size_t i) const { return expr.element(i) * factor; }
+    value_type element(size_t row, size_t col) const { return expr.element(row, col) * factor; }
+    bool aliases(const void* p) const { return expr.aliases(p); }
+
+private:
+    typename ExprOperand<E>::type expr;
+    value_type factor;
+};
+
+template <typename E>
+class MatrixTransposed : public MatrixExpr<MatrixTransposed<E>> {
+public:
+    using value_type = typename E::value_type;
+    static constexpr size_t rows = E::cols;
+    static constexpr size_t cols = E::rows;
+    static constexpr bool linear = false;
+
+    explicit MatrixTransposed(const E& expr) : expr(expr) {}
+
+    value_type element(size_t row, size_t col) const { return expr.element(col, row); }
+    bool aliases(const void* p) const { return expr.aliases(p); }
+
+private:
+    typename ExprOperand<E>::type expr;
+};
 
 template <size_t Rows, size_t Cols, typename T = double>
-class Matrix {
+class Matrix : public MatrixExpr<Matrix<Rows, Cols, T>> {
 public:
-    Matrix() : data(std::make_unique<T[]>(Rows * Cols)) {
-        for (size_t i = 0; i < Rows * Cols; ++i) {
-            data[i] = T{};
+    using value_type = T;
+    static constexpr size_t rows = Rows;
+    static constexpr size_t cols = Cols;
+    static constexpr bool linear = true;
+    static constexpr bool inline_storage = Rows * Cols * sizeof(T) <= MATRIX_INLINE_BYTES;
+
+    Matrix() = default;
+
+    // Leaves the elements uninitialized for a caller that writes them all.
+    explicit Matrix(NoInit) : storage(NoInit{}) {}
+
+    // Evaluates a whole expression in one pass, without temporaries.
+    template <typename E>
+    Matrix(const MatrixExpr<E>& expr) : storage(NoInit{}) {
+        assign(expr.self());
+    }
+
+    template <typename E>
+    Matrix& operator=(const MatrixExpr<E>& expr) {
+        // Only a transposed read of the destination can see a half-written
+        // result; element-wise nodes read each index before writing it.
+        if (!E::linear && expr.self().aliases(this)) {
+            return *this = Matrix(expr);
+        }
+        storage.allocate();
+        assign(expr.self());
+        return *this;
+    }
+
+    T& operator()(size_t row, size_t col) {
+        if (MATRIX_CHECKED) checkIndices(row, col, Rows, Cols);
+        return storage[row * Cols + col];
+    }
+
+    const T& operator()(size_t row, size_t col) const {
+        if (MATRIX_CHECKED) checkIndices(row, col, Rows, Cols);
+        return storage[row * Cols + col];
+    }
+
+    T& at(size_t row, size_t col) {
+        checkIndices(row, col, Rows, Cols);
+        return storage[row * Cols + col];
+    }
+
+    const T& at(size_t row, size_t col) const {
+        checkIndices(row, col, Rows, Cols);
+        return storage[row * Cols + col];
+    }
+
+    void print() const {
+        for (size_t i = 0; i < Rows; ++i) {
+            const T* values = row(i);
+            for (size_t j = 0; j < Cols; ++j) {
+                std::cout << values[j] << ' ';
+            }
+            std::cout << '\n';
+        }
+    }
+
+    T* data() { return storage.get(); }
+    const T* data() const { return storage.get(); }
+    T* row(size_t i) { return data() + i * Cols; }
+    const T* row(size_t i) const { return data() + i * Cols; }
+    MatrixView<T> view() { return MatrixView<T>(data(), Rows, Cols, Cols); }
+    MatrixView<const T> view() const { return MatrixView<const T>(data(), Rows, Cols, Cols); }
+    const T& element(size_t i) const { return storage[i]; }
+    const T& element(size_t row, size_t col) const { return storage[row * Cols + col]; }
+    bool aliases(const void* p) const { return p == this; }
+
+private:
+    MatrixStorage<T, Rows * Cols> storage;
+
+    template <typename E>
+    void assign(const E& expr) {
+        static_assert(E::rows == Rows && E::cols == Cols, "Matrix dimensions must match");
+        static_assert(std::is_same<typename E::value_type, T>::value, "Matrix element types must match");
+        if constexpr (Rows * Cols >= MATRIX_PARALLEL_WORK) {
+            parallelFor(Rows, Rows * Cols, [&](size_t begin, size_t end) { assignRows(expr, begin, end); });
+        } else {
+            assignRows(expr, 0, Rows);
+        }
+    }
+
+    template <typename E>
+    void assignRows(const E& expr, size_t begin, size_t end) {
+        if constexpr (E::linear) {
+            for (size_t i = begin * Cols; i < end * Cols; ++i) {
+                storage[i] = expr.element(i);
+            }
+        } else {
+            for (size_t i = begin; i < end; ++i) {
+                for (size_t j = 0; j < Cols; ++j) {
+                    storage[i * Cols + j] = expr.element(i, j);
+                }
+            }
+        }
+    }
+};
+
+// Materializes an expression; a Matrix is passed through untouched.
+template <size_t Rows, size_t Cols, typename T>
+const Matrix<Rows, Cols, T>& evaluate(const Matrix<Rows, Cols, T>& mat) {
+    return mat;
+}
+
+template <typename E>
+Matrix<E::rows, E::cols, typename E::value_type> evaluate(const MatrixExpr<E>& expr) {
+    return expr;
+}
+
+template <typename L, typename R>
+MatrixBinary<L, R, std::plus<typename L::value_type>> operator+(const MatrixExpr<L>& lhs, const MatrixExpr<R>& rhs) {
+    return {lhs.self(), rhs.self()};
+}
+
+template <typename L, typename R>
+MatrixBinary<L, R, std::minus<typename L::value_type>> operator-(const MatrixExpr<L>& lhs, const MatrixExpr<R>& rhs) {
+    return {lhs.self(), rhs.self()};
+}
+
+template <typename E>
+MatrixScaled<E> operator*(const MatrixExpr<E>& expr, typename E::value_type factor) {
+    return {expr.self(), factor};
+}
+
+template <typename E>
+MatrixScaled<E> operator*(typename E::value_type factor, const MatrixExpr<E>& expr) {
+    return {expr.self(), factor};
+}
+
+// Every product element reads a whole row and column, so the operands are
+// evaluated once up front rather than re-computed per access.
+template <typename L, typename R>
+Matrix<L::rows, R::cols, typename L::value_type> operator*(const MatrixExpr<L>& lhs, const MatrixExpr<R>& rhs) {
+    static_assert(L::cols == R::rows, "Inner matrix dimensions must match");
+    static_assert(std::is_same<typename L::value_type, typename R::value_type>::value,
+                  "Matrix element types must match");
+    const auto& a = evaluate(lhs.self());
+    const auto& b = evaluate(rhs.self());
+    Matrix<L::rows, R::cols, typename L::value_type> result{NoInit{}};
+    if constexpr (L::rows * R::cols * L::cols <= GEMM_SMALL_WORK) {
+        // Tiny shapes: let the compiler unroll the whole product.
+        for (size_t i = 0; i < L::rows; ++i) {
+            for (size_t j = 0; j < R::cols; ++j) {
+                typename L::value_type sum{};
+                for (size_t k = 0; k < L::cols; ++k) {
+                    sum += a.data()[i * L::cols + k] * b.data()[k * R::cols + j];
+                }
+                result.data()[i * R::cols + j] = sum;
+            }
+        }
+    } else {
+        gemm(L::rows, R::cols, L::cols, a.data(), L::cols, b.data(), R::cols, result.data(), R::cols);
+    }
+    return result;
+}
+
+template <size_t Rows, size_t Cols, typename T>
+auto transpose(Matrix<Rows, Cols, T>&& mat) {
+    Matrix<Cols, Rows, T> result{NoInit{}};
+    transposeKernel(Rows, Cols, mat.data(), Cols, result.data(), Rows);
+    return result;
+}
+
+// A square matrix is transposed in its own buffer, which the result takes
+// over.
+template <size_t N, typename T>
+Matrix<N, N, T> transpose(Matrix<N, N, T>&& mat) {
+    transposeSquareInPlace(N, mat.data(), N);
+    return std::move(mat);
+}
+
+template <typename E>
+MatrixTransposed<E> transpose(const MatrixExpr<E>& expr) {
+    return MatrixTransposed<E>(expr.self());
+}
+
+// Replacing lambda with a function template for trace
+template <typename E>
+typename E::value_type trace(const MatrixExpr<E>& expr) {
+    static_assert(E::rows == E::cols, "Trace needs a square matrix");
+    typename E::value_type trace{};
+    for (size_t i = 0; i < E::rows; ++i) {
+        trace += expr.self().element(i, i);
+    }
+    return trace;
+}
+
+// Rows of a DynamicMatrix start on this boundary once they are at least
+// this wide, so kernels see aligned rows.
+const size_t MATRIX_ALIGNMENT = 64;
+
+// Matrix whose shape is chosen at run time. Elements are row-major in one
+// aligned buffer; wide rows are padded to a whole number of cache lines, so
+// stride() can exceed cols(). All arithmetic goes through the same
+// pointer-and-stride kernels as the fixed-size Matrix, and accepts views.
+template <typename T = double>
+class DynamicMatrix {
+public:
+    using value_type = T;
+
+    DynamicMatrix() : DynamicMatrix(0, 0) {}
+
+    DynamicMatrix(size_t rows, size_t cols) : DynamicMatrix(rows, cols, NoInit{}) {
+        for (size_t i = 0; i < numRows; ++i) {
+            std::fill(elements + i * rowStride, elements + i * rowStride + numCols, T{});
+        }
+    }
+
+    DynamicMatrix(size_t rows, size_t cols, NoInit)
+        : numRows(rows), numCols(cols), rowStride(paddedStride(cols)) {
+        elements = static_cast<T*>(::operator new(std::max<size_t>(1, rows * rowStride * sizeof(T)), std::align_val_t(MATRIX_ALIGNMENT)));
+        std::uninitialized_default_construct_n(elements, rows * rowStride);
+    }
+
+    explicit DynamicMatrix(MatrixView<const T> other) : DynamicMatrix(other.rows(), other.cols(), NoInit{}) {
+        copyFrom(other);
+    }
+
+    template <size_t Rows, size_t Cols>
+    explicit DynamicMatrix(const Matrix<Rows, Cols, T>& other) : DynamicMatrix(other.view()) {}
+
+    DynamicMatrix(const DynamicMatrix& other) : DynamicMatrix(other.view()) {}
+
+    DynamicMatrix(DynamicMatrix&& other) noexcept
+        : elements(other.elements), numRows(other.numRows), numCols(other.numCols), rowStride(other.rowStride) {
+        other.elements = nullptr;
+        other.numRows = other.numCols = other.rowStride = 0;
+    }
+
+    ~DynamicMatrix() {
+        release();
+    }
+
+    DynamicMatrix& operator=(const DynamicMatrix& other) {
+        if (this != &other) {
+            if (numRows == other.numRows && numCols == other.numCols && elements) {
+                copyFrom(other.view());
+            } else {
+                *this = DynamicMatrix(other);
+            }
+        }
+        return *this;
+    }
+
+    DynamicMatrix& operator=(DynamicMatrix&& other) noexcept {
+        if (this != &other) {
+            release();
+            elements = other.elements;
+            numRows = other.numRows;
+            numCols = other.numCols;
+            rowStride = other.rowStride;
+            other.elements = nullptr;
+            other.numRows = other.numCols = other.rowStride = 0;
+        }
+        return *this;
+    }
+
+    T& operator()(size_t row, size_t col) {
+        return view()(row, col);
+    }
+
+    const T& operator()(size_t row, size_t col) const {
+        return view()(row, col);
+    }
+
+    T& at(size_t row, size_t col) {
+        return view().at(row, col);
+    }
+
+    const T& at(size_t row, size_t col) const {
+        return view().at(row, col);
+    }
+
+    MatrixView<T> view() { return MatrixView<T>(elements, numRows, numCols, rowStride); }
+    MatrixView<const T> view() const { return MatrixView<const T>(elements, numRows, numCols, rowStride); }
+
+    MatrixView<T> block(size_t row, size_t col, size_t rows, size_t cols) {
+        return view().block(row, col, rows, cols);
+    }
+
+    MatrixView<const T> block(size_t row, size_t col, size_t rows, size_t cols) const {
+        return view().block(row, col, rows, cols);
+    }
+
+    T* data() { return elements; }
+    const T* data() const { return elements; }
+    T* row(size_t i) { return elements + i * rowStride; }
+    const T* row(size_t i) const { return elements + i * rowStride; }
+    size_t rows() const { return numRows; }
+    size_t cols() const { return numCols; }
+    size_t stride() const { return rowStride; }
+
+    void print() const {
+        for (size_t i = 0; i < numRows; ++i) {
+            const T* values = row(i);
+            for (size_t j = 0; j < numCols; ++j) {
+                std::cout << values[j] << ' ';
+            }
+            std::cout << '\n';
+        }
+    }
+
+private:
+    T* elements = nullptr;
+    size_t numRows = 0;
+    size_t numCols = 0;
+    size_t rowStride = 0;
+
+    static size_t paddedStride(size_t cols) {
+        const size_t perLine = MATRIX_ALIGNMENT % sizeof(T) == 0 ? MATRIX_ALIGNMENT / sizeof(T) : 1;
+        return cols < perLine ? cols : (cols + perLine - 1) / perLine * perLine;
+    }
+
+    void copyFrom(MatrixView<const T> other) {
+        for (size_t i = 0; i < numRows; ++i) {
+            std::copy(other.data() + i * other.stride(), other.data() + i * other.stride() + numCols,
+                      elements + i * rowStride);
+        }
+    }
+
+    void release() {
+        if (!elements) return;
+        std::destroy_n(elements, numRows * rowStride);
+        ::operator delete(elements, std::align_val_t(MATRIX_ALIGNMENT));
+        elements = nullptr;
+    }
+};
+
+// Operands of the run-time-shaped operators: DynamicMatrix and views of any
+// matrix, so blocks take part in arithmetic without being copied out.
+template <typename M>
+struct DynamicOperand : std::false_type {};
+
+template <typename T>
+struct DynamicOperand<DynamicMatrix<T>> : std::true_type {
+    using value_type = T;
+};
+
+template <typename T>
+struct DynamicOperand<MatrixView<T>> : std::true_type {
+    using value_type = std::remove_const_t<T>;
+};
+
+template <typename A, typename B>
+using DynamicResult = std::enable_if_t<DynamicOperand<A>::value && DynamicOperand<B>::value,
+                                       DynamicMatrix<typename DynamicOperand<A>::value_type>>;
+
+template <typename A, typename B, typename Op>
+DynamicResult<A, B> combine(const A& lhs, const B& rhs, Op op) {
+    auto a = lhs.view();
+    auto b = rhs.view();
+    if (a.rows() != b.rows() || a.cols() != b.cols()) {
+        throw std::invalid_argument("Matrix dimensions must match");
+    }
+    DynamicMatrix<typename DynamicOperand<A>::value_type> result(a.rows(), a.cols(), NoInit{});
+    elementwise(a.rows(), a.cols(), a.data(), a.stride(), b.data(), b.stride(), result.data(), result.stride(), op);
+    return result;
+}
+
+template <typename A, typename B>
+DynamicResult<A, B> operator+(const A& lhs, const B& rhs) {
+    return combine(lhs, rhs, std::plus<typename DynamicOperand<A>::value_type>());
+}
+
+template <typename A, typename B>
+DynamicResult<A, B> operator-(const A& lhs, const B& rhs) {
+    return combine(lhs, rhs, std::minus<typename DynamicOperand<A>::value_type>());
+}
+
+template <typename A, typename B>
+DynamicResult<A, B> operator*(const A& lhs, const B& rhs) {
+    auto a = lhs.view();
+    auto b = rhs.view();
+    if (a.cols() != b.rows()) {
+        throw std::invalid_argument("Inner matrix dimensions must match");
+    }
+    DynamicMatrix<typename DynamicOperand<A>::value_type> result(a.rows(), b.cols(), NoInit{});
+    gemm(a.rows(), b.cols(), a.cols(), a.data(), a.stride(), b.data(), b.stride(), result.data(), result.stride());
+    return result;
+}
+
+template <typename A>
+DynamicResult<A, A> operator*(const A& mat, typename DynamicOperand<A>::value_type factor) {
+    auto a = mat.view();
+    DynamicMatrix<typename DynamicOperand<A>::value_type> result(a.rows(), a.cols(), NoInit{});
+    elementwise(a.rows(), a.cols(), a.data(), a.stride(), result.data(), result.stride(),
+                [factor](const auto& x) { return x * factor; });
+    return result;
+}
+
+template <typename A>
+DynamicResult<A, A> operator*(typename DynamicOperand<A>::value_type factor, const A& mat) {
+    return mat * factor;
+}
+
+template <typename A>
+DynamicResult<A, A> transpose(const A& mat) {
+    auto a = mat.view();
+    DynamicMatrix<typename DynamicOperand<A>::value_type> result(a.cols(), a.rows(), NoInit{});
+    transposeKernel(a.rows(), a.cols(), a.data(), a.stride(), result.data(), result.stride());
+    return result;
+}
+
+template <typename T>
+DynamicMatrix<T> transpose(DynamicMatrix<T>&& mat) {
+    if (mat.rows() != mat.cols()) {
+        return transpose(mat);
+    }
+    transposeSquareInPlace(mat.rows(), mat.data(), mat.stride());
+    return std::move(mat);
+}
+
+template <typename A>
+std::enable_if_t<DynamicOperand<A>::value, typename DynamicOperand<A>::value_type> trace(const A& mat) {
+    auto a = mat.view();
+    if (a.rows() != a.cols()) {
+        throw std::invalid_argument("Trace needs a square matrix");
+    }
+    typename DynamicOperand<A>::value_type trace{};
+    for (size_t i = 0; i < a.rows(); ++i) {
+        trace += a.data()[i * a.stride() + i];
+    }
+    return trace;
+}
+
+// Factors the m x n panel a (m >= n) in place as P * a = L * U with partial
+// pivoting: L is unit lower triangular below the diagonal, U upper on and
+// above it. Row j was swapped with row pivots[j]; swaps only touch the
+// panel's own columns. Returns false if a pivot was exactly zero.
+template <typename T>
+bool luUnblocked(size_t m, size_t n, T* a, size_t lda, size_t* pivots) {
+    bool regular = true;
+    for (size_t j = 0; j < n; ++j) {
+        size_t pivot = j;
+        T largest = std::abs(a[j * lda + j]);
+        for (size_t i = j + 1; i < m; ++i) {
+            if (std::abs(a[i * lda + j]) > largest) {
+                largest = std::abs(a[i * lda + j]);
+                pivot = i;
+            }
+        }
+        pivots[j] = pivot;
+        if (largest == T{}) {
+            regular = false;
+            continue;
+        }
+        if (pivot != j) {
+            std::swap_ranges(a + j * lda, a + j * lda + n, a + pivot * lda);
+        }
+        const T* top = a + j * lda;
+        const T scale = T{1} / top[j];
+        for (size_t i = j + 1; i < m; ++i) {
+            T* row = a + i * lda;
+            row[j] *= scale;
+            const T l = row[j];
+            for (size_t c = j + 1; c < n; ++c) {
+                row[c] -= l * top[c];
+            }
+        }
+    }
+    return regular;
+}
+
+// Right-looking blocked LU of the n x n matrix a. Each step factors a
+// panel of LU_BLOCK columns unblocked, solves for the matching block row of
+// U and updates the trailing matrix with one gemm, which carries nearly all
+// of the work for large n.
+constexpr size_t LU_BLOCK = 64;
+
+template <typename T>
+bool luBlocked(size_t n, T* a, size_t lda, size_t* pivots) {
+    if (n <= 2 * LU_BLOCK) return luUnblocked(n, n, a, lda, pivots);
+
+    bool regular = true;
+    std::vector<T> product;
+    for (size_t j = 0; j < n; j += LU_BLOCK) {
+        const size_t jb = std::min(LU_BLOCK, n - j);
+        const size_t next = j + jb;
+        regular = luUnblocked(n - j, jb, a + j * lda + j, lda, pivots + j) && regular;
+
+        // Apply the panel's swaps to the columns left and right of it.
+        for (size_t i = j; i < next; ++i) {
+            pivots[i] += j;
+            if (pivots[i] != i) {
+                std::swap_ranges(a + i * lda, a + i * lda + j, a + pivots[i] * lda);
+                std::swap_ranges(a + i * lda + next, a + i * lda + n, a + pivots[i] * lda + next);
+            }
+        }
+        if (next == n) break;
+
+        // U12 = L11^-1 * A12.
+        for (size_t r = j + 1; r < next; ++r) {
+            T* row = a + r * lda;
+            for (size_t p = j; p < r; ++p) {
+                const T l = row[p];
+                const T* above = a + p * lda;
+                for (size_t c = next; c < n; ++c) {
+                    row[c] -= l * above[c];
+                }
+            }
+        }
+
+        // A22 -= L21 * U12.
+        const size_t rest = n - next;
+        product.resize(rest * rest);
+        gemm(rest, rest, jb, a + next * lda + j, lda, a + j * lda + next, lda, product.data(), rest);
+        T* trailing = a + next * lda + next;
+        elementwise(rest, rest, trailing, lda, product.data(), rest, trailing, lda, std::minus<T>());
+    }
+    return regular;
+}
+
+// Solves L * U * X = P * B in place in b (n x k), given luBlocked's output.
+template <typename T>
+void luSolve(size_t n, const T* lu, size_t ldlu, const size_t* pivots, size_t k, T* b, size_t ldb) {
+    for (size_t i = 0; i < n; ++i) {
+        if (pivots[i] != i) {
+            std::swap_ranges(b + i * ldb, b + i * ldb + k, b + pivots[i] * ldb);
+        }
+    }
+    if (k == 1) {
+        // A single right-hand side: each step is a dot product along a row
+        // of the factors.
+        for (size_t i = 1; i < n; ++i) {
+            T sum{};
+            for (size_t p = 0; p < i; ++p) {
+                sum += lu[i * ldlu + p] * b[p * ldb];
+            }
+            b[i * ldb] -= sum;
+        }
+        for (size_t i = n; i-- > 0;) {
+            T sum{};
+            for (size_t p = i + 1; p < n; ++p) {
+                sum += lu[i * ldlu + p] * b[p * ldb];
+            }
+            b[i * ldb] = (b[i * ldb] - sum) / lu[i * ldlu + i];
+        }
+        return;
+    }
+    for (size_t i = 1; i < n; ++i) {
+        T* row = b + i * ldb;
+        for (size_t p = 0; p < i; ++p) {
+            const T l = lu[i * ldlu + p];
+            const T* solved = b + p * ldb;
+            for (size_t c = 0; c < k; ++c) {
+                row[c] -= l * solved[c];
+            }
+        }
+    }
+    for (size_t i = n; i-- > 0;) {
+        T* row = b + i * ldb;
+        for (size_t p = i + 1; p < n; ++p) {
+            const T u = lu[i * ldlu + p];
+            const T* solved = b + p * ldb;
+            for (size_t c = 0; c < k; ++c) {
+                row[c] -= u * solved[c];
+            }
+        }
+        const T scale = T{1} / lu[i * ldlu + i];
+        for (size_t c = 0; c < k; ++c) {
+            row[c] *= scale;
+        }
+    }
+}
+
+// Pivot indices live inline for fixed-size matrices and on the heap for
+// DynamicMatrix.
+template <typename M>
+struct PivotStorage {
+    using type = std::vector<size_t>;
+    static type make(size_t n) { return type(n); }
+};
+
+template <size_t N, typename T>
+struct PivotStorage<Matrix<N, N, T>> {
+    using type = std::array<size_t, N>;
+    static type make(size_t) { return type{}; }
+};
+
+// LU factorization of a square Matrix or DynamicMatrix, reusable for any
+// number of solves.
+template <typename M>
+class LUDecomposition {
+public:
+    using value_type = typename M::value_type;
+    static_assert(std::is_floating_point<value_type>::value, "LU needs a floating-point element type");
+
+    explicit LUDecomposition(M a) : lu(std::move(a)), pivots(PivotStorage<M>::make(lu.view().rows())) {
+        MatrixView<value_type> v = lu.view();
+        if (v.rows() != v.cols()) {
+            throw std::invalid_argument("LU needs a square matrix");
+        }
+        regular = luBlocked(v.rows(), v.data(), v.stride(), pivots.data());
+    }
+
+    bool singular() const { return !regular; }
+    const M& factors() const { return lu; }
+
+    value_type determinant() const {
+        MatrixView<const value_type> v = lu.view();
+        value_type det{1};
+        for (size_t i = 0; i < v.rows(); ++i) {
+            det *= pivots[i] != i ? -v.row(i)[i] : v.row(i)[i];
+        }
+        return regular ? det : value_type{};
+    }
+
+    // Returns X with A * X = b; b is a Matrix or DynamicMatrix with as many
+    // rows as A.
+    template <typename B>
+    B solve(B b) const {
+        if (!regular) throw std::domain_error("Matrix is singular");
+        MatrixView<const value_type> v = lu.view();
+        MatrixView<value_type> x = b.view();
+        if (x.rows() != v.rows()) {
+            throw std::invalid_argument("Matrix dimensions must match");
+        }
+        luSolve(v.rows(), v.data(), v.stride(), pivots.data(), x.cols(), x.data(), x.stride());
+        return b;
+    }
+
+    M inverse() const {
+        M identity = lu;
+        MatrixView<value_type> v = identity.view();
+        for (size_t i = 0; i < v.rows(); ++i) {
+            std::fill(v.row(i), v.row(i) + v.cols(), value_type{});
+            v.row(i)[i] = value_type{1};
+        }
+        return solve(std::move(identity));
+    }
+
+private:
+    M lu;
+    typename PivotStorage<M>::type pivots;
+    bool regular = true;
+};
+
+// Tiny fixed sizes use closed forms the compiler fully unrolls; larger
+// ones go through LU.
+template <size_t N, typename T>
+T det(const Matrix<N, N, T>& a) {
+    if constexpr (N == 1) {
+        return a.element(0, 0);
+    } else if constexpr (N == 2) {
+        return a.element(0, 0) * a.element(1, 1) - a.element(0, 1) * a.element(1, 0);
+    } else if constexpr (N == 3) {
+        return a.element(0, 0) * (a.element(1, 1) * a.element(2, 2) - a.element(1, 2) * a.element(2, 1))
+             - a.element(0, 1) * (a.element(1, 0) * a.element(2, 2) - a.element(1, 2) * a.element(2, 0))
+             + a.element(0, 2) * (a.element(1, 0) * a.element(2, 1) - a.element(1, 1) * a.element(2, 0));
+    } else {
+        return LUDecomposition<Matrix<N, N, T>>(a).determinant();
+    }
+}
+
+template <size_t N, typename T>
+Matrix<N, N, T> inverse(const Matrix<N, N, T>& a) {
+    if constexpr (N == 2) {
+        const T d = det(a);
+        if (d == T{}) throw std::domain_error("Matrix is singular");
+        Matrix<2, 2, T> result{NoInit{}};
+        result.data()[0] = a.element(1, 1) / d;
+        result.data()[1] = -a.element(0, 1) / d;
+        result.data()[2] = -a.element(1, 0) / d;
+        result.data()[3] = a.element(0, 0) / d;
+        return result;
+    } else {
+        return LUDecomposition<Matrix<N, N, T>>(a).inverse();
+    }
+}
+
+template <size_t N, size_t K, typename T>
+Matrix<N, K, T> solve(const Matrix<N, N, T>& a, const Matrix<N, K, T>& b) {
+    return LUDecomposition<Matrix<N, N, T>>(a).solve(b);
+}
+
+template <typename T>
+T det(const DynamicMatrix<T>& a) {
+    return LUDecomposition<DynamicMatrix<T>>(a).determinant();
+}
+
+template <typename T>
+DynamicMatrix<T> inverse(const DynamicMatrix<T>& a) {
+    return LUDecomposition<DynamicMatrix<T>>(a).inverse();
+}
+
+template <typename T>
+DynamicMatrix<T> solve(const DynamicMatrix<T>& a, const DynamicMatrix<T>& b) {
+    return LUDecomposition<DynamicMatrix<T>>(a).solve(b);
+}
+
+// Compressed sparse row matrix: the non-zeros of row i are values[k] at
+// column columns[k] for k in [rowStart[i], rowStart[i + 1]), in column
+// order. The transpose of a CSR matrix is the CSC form of the original, so
+// transpose() doubles as the CSR-to-CSC conversion.
+template <typename T = double>
+class SparseMatrix {
+public:
+    using value_type = T;
+
+    SparseMatrix() : rowStart(1, 0) {}
+
+    // Keeps the elements whose magnitude exceeds tolerance.
+    explicit SparseMatrix(MatrixView<const T> dense, T tolerance = T{})
+        : numRows(dense.rows()), numCols(dense.cols()), rowStart(dense.rows() + 1, 0) {
+        for (size_t i = 0; i < numRows; ++i) {
+            const T* row = dense.row(i);
+            for (size_t j = 0; j < numCols; ++j) {
+                if (std::abs(row[j]) > tolerance) {
+                    columns.push_back(j);
+                    values.push_back(row[j]);
+                }
+            }
+            rowStart[i + 1] = values.size();
+        }
+    }
+
+    template <size_t Rows, size_t Cols>
+    explicit SparseMatrix(const Matrix<Rows, Cols, T>& dense, T tolerance = T{}) : SparseMatrix(dense.view(), tolerance) {}
+
+    explicit SparseMatrix(const DynamicMatrix<T>& dense, T tolerance = T{}) : SparseMatrix(dense.view(), tolerance) {}
+
+    size_t rows() const { return numRows; }
+    size_t cols() const { return numCols; }
+    size_t nonzeros() const { return values.size(); }
+
+    size_t memory_bytes() const {
+        return rowStart.size() * sizeof(size_t) + columns.size() * sizeof(size_t) + values.size() * sizeof(T);
+    }
+
+    const std::vector<size_t>& row_starts() const { return rowStart; }
+    const std::vector<size_t>& column_indices() const { return columns; }
+    const std::vector<T>& nonzero_values() const { return values; }
+
+    DynamicMatrix<T> to_dense() const {
+        DynamicMatrix<T> dense(numRows, numCols);
+        for (size_t i = 0; i < numRows; ++i) {
+            T* row = dense.row(i);
+            for (size_t k = rowStart[i]; k < rowStart[i + 1]; ++k) {
+                row[columns[k]] = values[k];
+            }
+        }
+        return dense;
+    }
+
+    // Counting sort by column: one pass to size the output rows, one to
+    // scatter. Rows are visited in order, so each output row stays sorted.
+    SparseMatrix transposed() const {
+        SparseMatrix result;
+        result.numRows = numCols;
+        result.numCols = numRows;
+        result.rowStart.assign(numCols + 1, 0);
+        result.columns.resize(values.size());
+        result.values.resize(values.size());
+        for (size_t column : columns) {
+            ++result.rowStart[column + 1];
+        }
+        for (size_t j = 0; j < numCols; ++j) {
+            result.rowStart[j + 1] += result.rowStart[j];
+        }
+        std::vector<size_t> next(result.rowStart.begin(), result.rowStart.end() - 1);
+        for (size_t i = 0; i < numRows; ++i) {
+            for (size_t k = rowStart[i]; k < rowStart[i + 1]; ++k) {
+                size_t slot = next[columns[k]]++;
+                result.columns[slot] = i;
+                result.values[slot] = values[k];
+            }
+        }
+        return result;
+    }
+
+private:
+    size_t numRows = 0;
+    size_t numCols = 0;
+    std::vector<size_t> rowStart;
+    std::vector<size_t> columns;
+    std::vector<T> values;
+};
+
+template <typename T>
+SparseMatrix<T> transpose(const SparseMatrix<T>& mat) {
+    return mat.transposed();
+}
+
+// Sparse x dense: each output row is a sum of the dense rows picked by the
+// sparse row's non-zeros. Rows are split across the pool.
+template <typename T, typename B>
+std::enable_if_t<DynamicOperand<B>::value, DynamicMatrix<T>> operator*(const SparseMatrix<T>& lhs, const B& rhs) {
+    MatrixView<const T> b = rhs.view();
+    if (lhs.cols() != b.rows()) {
+        throw std::invalid_argument("Inner matrix dimensions must match");
+    }
+    DynamicMatrix<T> result(lhs.rows(), b.cols());
+    const size_t* starts = lhs.row_starts().data();
+    const size_t* columns = lhs.column_indices().data();
+    const T* values = lhs.nonzero_values().data();
+    T* out = result.data();
+    const size_t ldc = result.stride();
+    const size_t n = b.cols();
+    parallelFor(lhs.rows(), lhs.nonzeros() * n, [=](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            T* row = out + i * ldc;
+            for (size_t k = starts[i]; k < starts[i + 1]; ++k) {
+                const T v = values[k];
+                const T* source = b.row(columns[k]);
+                for (size_t j = 0; j < n; ++j) {
+                    row[j] += v * source[j];
+                }
+            }
+        }
+    });
+    return result;
+}
+
+template <typename T, size_t Rows, size_t Cols>
+DynamicMatrix<T> operator*(const SparseMatrix<T>& lhs, const Matrix<Rows, Cols, T>& rhs) {
+    return lhs * rhs.view();
+}
+
+// Sparse x vector, one dot product per row.
+template <typename T>
+std::vector<T> operator*(const SparseMatrix<T>& lhs, const std::vector<T>& x) {
+    if (lhs.cols() != x.size()) {
+        throw std::invalid_argument("Matrix and vector dimensions must match");
+    }
+    std::vector<T> y(lhs.rows());
+    const size_t* starts = lhs.row_starts().data();
+    const size_t* columns = lhs.column_indices().data();
+    const T* values = lhs.nonzero_values().data();
+    const T* in = x.data();
+    T* out = y.data();
+    parallelFor(lhs.rows(), lhs.nonzeros(), [=](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            T sum{};
+            for (size_t k = starts[i]; k < starts[i + 1]; ++k) {
+                sum += values[k] * in[columns[k]];
+            }
+            out[i] = sum;
+        }
+    });
+    return y;
+}
+
+// Binary matrix files hold this header, then rows * cols elements row-major
+// without padding, in the host's byte order, starting at payloadOffset
+// (a multiple of MATRIX_ALIGNMENT) so a mapping of the file can be used in
+// place.
+struct MatrixFileHeader {
+    char magic[4];
+    std::uint32_t elementType;
+    std::uint64_t rows;
+    std::uint64_t cols;
+    std::uint64_t payloadOffset;
+};
+
+const char MATRIX_FILE_MAGIC[4] = {'M', 'T', 'X', '1'};
+
+template <typename T>
+struct MatrixElementType;
+
+template <>
+struct MatrixElementType<float> {
+    static constexpr std::uint32_t code = 1;
+};
+
+template <>
+struct MatrixElementType<double> {
+    static constexpr std::uint32_t code = 2;
+};
+
+template <>
+struct MatrixElementType<std::int32_t> {
+    static constexpr std::uint32_t code = 3;
+};
+
+template <>
+struct MatrixElementType<std::int64_t> {
+    static constexpr std::uint32_t code = 4;
+};
+
+template <typename T>
+MatrixFileHeader checkHeader(const MatrixFileHeader& header, std::uint64_t fileSize, const std::string& path) {
+    if (std::memcmp(header.magic, MATRIX_FILE_MAGIC, sizeof(header.magic)) != 0) {
+        throw std::runtime_error(path + " is not a matrix file");
+    }
+    if (header.elementType != MatrixElementType<T>::code) {
+        throw std::runtime_error(path + " holds a different element type");
+    }
+    if (header.payloadOffset % alignof(T) != 0 || header.payloadOffset > fileSize
+        || (fileSize - header.payloadOffset) / sizeof(T) / std::max<std::uint64_t>(header.cols, 1) < header.rows) {
+        throw std::runtime_error(path + " is truncated or corrupt");
+    }
+    return header;
+}
+
+// Accepts a DynamicMatrix or any view, including a fixed-size Matrix's.
+template <typename M>
+std::enable_if_t<DynamicOperand<M>::value> saveBinary(const std::string& path, const M& source) {
+    using T = typename DynamicOperand<M>::value_type;
+    MatrixView<const T> mat = source.view();
+    std::unique_ptr<std::FILE, int (*)(std::FILE*)> file(std::fopen(path.c_str(), "wb"), std::fclose);
+    if (!file) throw std::runtime_error("cannot open " + path);
+
+    char header[MATRIX_ALIGNMENT] = {};
+    MatrixFileHeader fields = {{}, MatrixElementType<T>::code, mat.rows(), mat.cols(), sizeof(header)};
+    std::memcpy(fields.magic, MATRIX_FILE_MAGIC, sizeof(fields.magic));
+    std::memcpy(header, &fields, sizeof(fields));
+    bool ok = std::fwrite(header, 1, sizeof(header), file.get()) == sizeof(header);
+    if (mat.stride() == mat.cols()) {
+        ok = ok && std::fwrite(mat.data(), sizeof(T), mat.rows() * mat.cols(), file.get()) == mat.rows() * mat.cols();
+    } else {
+        for (size_t i = 0; ok && i < mat.rows(); ++i) {
+            ok = std::fwrite(mat.row(i), sizeof(T), mat.cols(), file.get()) == mat.cols();
+        }
+    }
+    if (!ok || std::fflush(file.get()) != 0) throw std::runtime_error("cannot write " + path);
+}
+
+template <typename T>
+DynamicMatrix<T> loadBinary(const std::string& path) {
+    std::unique_ptr<std::FILE, int (*)(std::FILE*)> file(std::fopen(path.c_str(), "rb"), std::fclose);
+    if (!file) throw std::runtime_error("cannot open " + path);
+    struct stat st;
+    MatrixFileHeader header;
+    if (::fstat(::fileno(file.get()), &st) != 0 || std::fread(&header, sizeof(header), 1, file.get()) != 1) {
+        throw std::runtime_error("cannot read " + path);
+    }
+    checkHeader<T>(header, static_cast<std::uint64_t>(st.st_size), path);
+
+    DynamicMatrix<T> mat(header.rows, header.cols, NoInit{});
+    bool ok = std::fseek(file.get(), static_cast<long>(header.payloadOffset), SEEK_SET) == 0;
+    for (size_t i = 0; ok && i < mat.rows(); ++i) {
+        ok = std::fread(mat.row(i), sizeof(T), mat.cols(), file.get()) == mat.cols();
+    }
+    if (!ok) throw std::runtime_error("cannot read " + path);
+    return mat;
+}
+
+// Read-only mapping of a whole file.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("cannot open " + path);
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("cannot stat " + path);
+        }
+        length = static_cast<size_t>(st.st_size);
+        if (length > 0) {
+            void* p = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("cannot map " + path);
+            }
+            bytes = static_cast<const char*>(p);
+        }
+        ::close(fd);
+    }
+
+    MappedFile(MappedFile&& other) noexcept : bytes(other.bytes), length(other.length) {
+        other.bytes = nullptr;
+        other.length = 0;
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (bytes) ::munmap(const_cast<char*>(bytes), length);
+    }
+
+    void advise(int advice) const {
+        if (bytes) ::madvise(const_cast<char*>(bytes), length, advice);
+    }
+
+    const char* begin() const { return bytes; }
+    const char* end() const { return bytes + length; }
+    size_t size() const { return length; }
+
+private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+};
+
+// A binary matrix file used in place: view() points straight into the
+// mapping, so opening costs no copy and pages are read on first touch.
+template <typename T>
+class MappedMatrix {
+public:
+    explicit MappedMatrix(const std::string& path) : file(path) {
+        MatrixFileHeader header;
+        if (file.size() < sizeof(header)) throw std::runtime_error(path + " is not a matrix file");
+        std::memcpy(&header, file.begin(), sizeof(header));
+        checkHeader<T>(header, file.size(), path);
+        numRows = header.rows;
+        numCols = header.cols;
+        elements = reinterpret_cast<const T*>(file.begin() + header.payloadOffset);
+    }
+
+    MatrixView<const T> view() const { return MatrixView<const T>(elements, numRows, numCols, numCols); }
+
+    const T& operator()(size_t row, size_t col) const { return view()(row, col); }
+    const T* data() const { return elements; }
+    size_t rows() const { return numRows; }
+    size_t cols() const { return numCols; }
+
+private:
+    MappedFile file;
+    const T* elements = nullptr;
+    size_t numRows = 0;
+    size_t numCols = 0;
+};
+
+template <typename T>
+struct DynamicOperand<MappedMatrix<T>> : std::true_type {
+    using value_type = T;
+};
+
+// Text matrices are "rows cols" followed by the elements row by row,
+// separated by any whitespace.
+template <typename T>
+DynamicMatrix<T> loadText(const std::string& path) {
+    MappedFile file(path);
+    file.advise(MADV_SEQUENTIAL);
+    const char* p = file.begin();
+    const char* end = file.end();
+
+    auto next = [&](auto& value) {
+        while (p != end && std::isspace(static_cast<unsigned char>(*p))) ++p;
+        auto result = std::from_chars(p, end, value);
+        if (result.ec != std::errc()) {
+            throw std::runtime_error(path + ": malformed number at byte " + std::to_string(p - file.begin()));
+        }
+        p = result.ptr;
+    };
+
+    size_t rows, cols;
+    next(rows);
+    next(cols);
+    DynamicMatrix<T> mat(rows, cols, NoInit{});
+    for (size_t i = 0; i < rows; ++i) {
+        T* values = mat.row(i);
+        for (size_t j = 0; j < cols; ++j) {
+            next(values[j]);
         }
     }
+    return mat;
+}
 
-    ~Matrix() = default;
+// Formats with to_chars into a 64 KiB buffer that is written out whenever
+// it fills, rather than streaming every element separately.
+template <typename M>
+std::enable_if_t<DynamicOperand<M>::value> saveText(const std::string& path, const M& source) {
+    using T = typename DynamicOperand<M>::value_type;
+    MatrixView<const T> mat = source.view();
+    std::unique_ptr<std::FILE, int (*)(std::FILE*)> file(std::fopen(path.c_str(), "wb"), std::fclose);
+    if (!file) throw std::runtime_error("cannot open " + path);
 
-    Matrix(const Matrix& other) : Matrix() {
-        for (size_t i = 0; i < Rows * Cols; ++i) {
-            data[i] = other.data[i];
+    const size_t capacity = 1 << 16;
+    const size_t maxElement = 64;
+    std::unique_ptr<char[]> buffer(new char[capacity]);
+    size_t used = 0;
+    bool ok = true;
+    auto flush = [&] {
+        ok = ok && std::fwrite(buffer.get(), 1, used, file.get()) == used;
+        used = 0;
+    };
+    auto put = [&](auto value, char separator) {
+        if (used + maxElement > capacity) flush();
+        char* last = std::to_chars(buffer.get() + used, buffer.get() + capacity, value).ptr;
+        *last++ = separator;
+        used = last - buffer.get();
+    };
+
+    put(mat.rows(), ' ');
+    put(mat.cols(), '\n');
+    for (size_t i = 0; i < mat.rows(); ++i) {
+        const T* values = mat.row(i);
+        for (size_t j = 0; j < mat.cols(); ++j) {
+            put(values[j], j + 1 == mat.cols() ? '\n' : ' ');
         }
     }
+    flush();
+    if (!ok || std::fflush(file.get()) != 0) throw std::runtime_error("cannot write " + path);
+}
 
-    Matrix(Matrix&& other) noexcept : data(std::move(other.data)) {}
-
-    Matrix& operator=(const Matrix& other) {
-        if (this != &other) {
-            for (size_t i = 0; i < Rows * Cols; ++i) {
-                data[i] = other.data[i];
+// Reads every element of dst from std::cin, re-prompting on bad input.
+template <typename T>
+void readMatrix(const std::string& name, MatrixView<T> dst) {
+    std::cout << "Enter values for " << dst.rows() << "x" << dst.cols() << " matrix " << name << " (row-wise):\n";
+    for (size_t i = 0; i < dst.rows(); ++i) {
+        for (size_t j = 0; j < dst.cols(); ++j) {
+            std::cout << "Enter value for [" << i << "][" << j << "]: ";
+            while (!(std::cin >> dst(i, j))) {
+                std::cin.clear();
+                std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+                std::cout << "Invalid input. Please enter a number: ";
             }
         }
-        return *this;
     }
+}
 
-    Matrix& operator=(Matrix&& other) noexcept {
-        if (this != &other) {
-            data = std::move(other.data);
+Matrix<2, 2> createSquareMatrix(const std::string& name) {
+    Matrix<2, 2> mat;
+    readMatrix(name, mat.view());
+    return mat;
+}
+
+Matrix<2, 3> create2x3Matrix(const std::string& name) {
+    Matrix<2, 3> mat;
+    readMatrix(name, mat.view());
+    return mat;
+}
+
+Matrix<3, 2> create3x2Matrix(const std::string& name) {
+    Matrix<3, 2> mat;
+    readMatrix(name, mat.view());
+    return mat;
+}
+
+DynamicMatrix<> createDynamicMatrix(const std::string& name) {
+    size_t rows, cols;
+    std::cout << "Enter the number of rows and columns of matrix " << name << ": ";
+    while (!(std::cin >> rows >> cols) || rows == 0 || cols == 0) {
+        std::cin.clear();
+        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        std::cout << "Invalid input. Please enter two positive numbers: ";
+    }
+    DynamicMatrix<> mat(rows, cols);
+    readMatrix(name, mat.view());
+    return mat;
+}
+
+// A chained expression producing five temporaries: a product, a sum, a
+// difference and a transpose, consumed by trace.
+template <size_t N>
+void benchmarkSmallChain(int rounds) {
+    Matrix<N, N> a, b, c;
+    for (size_t i = 0; i < N; ++i) {
+        for (size_t j = 0; j < N; ++j) {
+            a(i, j) = 1.0 / (i + j + 1);
+            b(i, j) = static_cast<double>(i) - j;
+            c(i, j) = 0.5;
         }
-        return *this;
     }
 
-    T& operator()(size_t row, size_t col) {
-        if (row >= Rows || col >= Cols) {
-            throw std::out_of_range("Matrix indices out of range");
+    double sink = 0;
+    long long allocsBefore = heapAllocations;
+    double ns = timeNs([&] {
+        for (int r = 0; r < rounds; ++r) {
+            c(0, 0) = r;
+            sink += trace(transpose(a * b + c - a));
+        }
+    });
+    long long allocs = heapAllocations - allocsBefore;
+    benchmarkSink = sink;
+
+    std::cout << "  " << N << "x" << N << (Matrix<N, N>::inline_storage ? " (inline): " : " (heap):   ")
+              << ns / rounds << " ns/expr, "
+              << static_cast<double>(allocs) / rounds << " allocations/expr\n";
+}
+
+// D = A + B - C + 2A over large matrices, fused into one pass against the
+// operator-at-a-time evaluation that materializes every intermediate.
+template <size_t N>
+void benchmarkFusion(int rounds) {
+    Matrix<N, N> a, b, c, d;
+    for (size_t i = 0; i < N; ++i) {
+        for (size_t j = 0; j < N; ++j) {
+            a(i, j) = static_cast<double>(i + j);
+            b(i, j) = static_cast<double>(i) - j;
+            c(i, j) = 0.25;
         }
-        return data[row * Cols + col];
     }
 
-    const T& operator()(size_t row, size_t col) const {
-        if (row >= Rows || col >= Cols) {
-            throw std::out_of_range("Matrix indices out of range");
+    long long allocsBefore = heapAllocations;
+    double fusedNs = timeNs([&] {
+        for (int r = 0; r < rounds; ++r) {
+            d = a + b - c + 2.0 * a;
+        }
+    });
+    long long fusedAllocs = heapAllocations - allocsBefore;
+
+    allocsBefore = heapAllocations;
+    double eagerNs = timeNs([&] {
+        for (int r = 0; r < rounds; ++r) {
+            Matrix<N, N> sum = a + b;
+            Matrix<N, N> diff = sum - c;
+            Matrix<N, N> scaled = 2.0 * a;
+            d = diff + scaled;
+        }
+    });
+    long long eagerAllocs = heapAllocations - allocsBefore;
+    benchmarkSink = trace(d);
+
+    // Fused: three inputs read, one output written. Eager: every operator
+    // reads its operands and writes a full result.
+    const double matrixBytes = N * N * sizeof(double);
+    const double fusedBytes = 4 * matrixBytes;
+    const double eagerBytes = 11 * matrixBytes;
+    std::cout << "  " << N << "x" << N << " fused: " << fusedNs / rounds / 1e3 << " us, "
+              << fusedBytes / 1e6 << " MB moved, " << fusedAllocs / rounds << " allocations\n";
+    std::cout << "  " << N << "x" << N << " eager: " << eagerNs / rounds / 1e3 << " us, "
+              << eagerBytes / 1e6 << " MB moved, " << eagerAllocs / rounds << " allocations\n";
+}
+
+// The textbook i-j-k product through the checked accessor, as a baseline.
+template <size_t N>
+void naiveMultiply(const Matrix<N, N>& lhs, const Matrix<N, N>& rhs, Matrix<N, N>& result) {
+    for (size_t i = 0; i < N; ++i) {
+        for (size_t j = 0; j < N; ++j) {
+            double sum = 0;
+            for (size_t k = 0; k < N; ++k) {
+                sum += lhs(i, k) * rhs(k, j);
+            }
+            result(i, j) = sum;
         }
-        return data[row * Cols + col];
     }
+}
 
-    void print() const {
-        for (size_t i = 0; i < Rows; ++i) {
-            for (size_t j = 0; j < Cols; ++j) {
-                std::cout << (*this)(i, j) << ' ';
+template <size_t N>
+void benchmarkMultiply(bool withNaive) {
+    Matrix<N, N> a, b, c;
+    for (size_t i = 0; i < N; ++i) {
+        for (size_t j = 0; j < N; ++j) {
+            a(i, j) = 1.0 / (i + j + 1);
+            b(i, j) = static_cast<double>(i % 7) - static_cast<double>(j % 5);
+        }
+    }
+
+    // Enough repetitions for roughly 2^28 multiply-adds per measurement.
+    const int rounds = static_cast<int>(std::max<size_t>(1, (size_t(1) << 28) / (N * N * N)));
+    const double flops = 2.0 * N * N * N * rounds;
+    double tiledNs = timeNs([&] {
+        for (int r = 0; r < rounds; ++r) {
+            c = a * b;
+        }
+    });
+    std::cout << "  " << N << "x" << N << ": tiled " << flops / tiledNs << " GFLOP/s";
+    if (withNaive) {
+        double naiveNs = timeNs([&] {
+            for (int r = 0; r < rounds; ++r) {
+                naiveMultiply(a, b, c);
             }
-            std::cout << '\n';
+        });
+        std::cout << ", naive " << flops / naiveNs << " GFLOP/s";
+    }
+    std::cout << "\n";
+    benchmarkSink = trace(c);
+}
+
+// The same large product, sum and transpose with 1, 2, 4, ... threads up to
+// the hardware concurrency.
+void benchmarkScaling() {
+    const size_t N = 1024;
+    Matrix<N, N> a, b, c;
+    for (size_t i = 0; i < N; ++i) {
+        for (size_t j = 0; j < N; ++j) {
+            a(i, j) = 1.0 / (i + j + 1);
+            b(i, j) = static_cast<double>(i % 7) - static_cast<double>(j % 5);
         }
     }
 
-    Matrix operator+(const Matrix& other) const {
-        Matrix result;
-        for (size_t i = 0; i < Rows * Cols; ++i) {
-            result.data[i] = data[i] + other.data[i];
+    MatrixThreadPool& pool = MatrixThreadPool::instance();
+    unsigned hardware = std::max(1u, std::thread::hardware_concurrency());
+    double serialMultiply = 0, serialAdd = 0;
+    for (unsigned threads = 1;; threads = std::min(threads * 2, hardware)) {
+        pool.set_threads(threads);
+        double multiplyNs = timeNs([&] { c = a * b; });
+        double addNs = timeNs([&] {
+            for (int r = 0; r < 20; ++r) c = a + b - c;
+        }) / 20;
+        double transposeNs = timeNs([&] {
+            for (int r = 0; r < 20; ++r) c = transpose(Matrix<N, N>(a));
+        }) / 20;
+        if (threads == 1) {
+            serialMultiply = multiplyNs;
+            serialAdd = addNs;
         }
-        return result;
+        std::cout << "  " << threads << " thread(s): multiply " << multiplyNs / 1e6 << " ms (x"
+                  << serialMultiply / multiplyNs << "), add " << addNs / 1e6 << " ms (x"
+                  << serialAdd / addNs << "), copy+transpose " << transposeNs / 1e6 << " ms\n";
+        if (threads == hardware) break;
     }
+    pool.set_threads(hardware);
+    benchmarkSink = trace(c);
+}
 
-    Matrix operator-(const Matrix& other) const {
-        Matrix result;
-        for (size_t i = 0; i < Rows * Cols; ++i) {
-            result.data[i] = data[i] - other.data[i];
+// Transposes an n x n matrix of doubles: the old element-by-element loop
+// through the checked accessor, the tiled out-of-place kernel and the
+// in-place square kernel. Each moves 2 * n * n * 8 bytes.
+void benchmarkTranspose(size_t n, int rounds) {
+    DynamicMatrix<> a(n, n), b(n, n);
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < n; ++j) {
+            a(i, j) = static_cast<double>(i * n + j);
         }
-        return result;
     }
 
-private:
-    std::unique_ptr<T[]> data;
+    double naiveNs = timeNs([&] {
+        for (int r = 0; r < rounds; ++r) {
+            for (size_t i = 0; i < n; ++i) {
+                for (size_t j = 0; j < n; ++j) {
+                    b(j, i) = a(i, j);
+                }
+            }
+        }
+    });
+    double tiledNs = timeNs([&] {
+        for (int r = 0; r < rounds; ++r) {
+            transposeKernel(n, n, a.data(), a.stride(), b.data(), b.stride());
+        }
+    });
+    double inPlaceNs = timeNs([&] {
+        for (int r = 0; r < rounds; ++r) {
+            a = transpose(std::move(a));
+        }
+    });
+    benchmarkSink = trace(a) + trace(b);
+
+    const double bytes = 2.0 * n * n * sizeof(double) * rounds;
+    std::cout << "  " << n << "x" << n << ": naive " << bytes / naiveNs << " GB/s, tiled "
+              << bytes / tiledNs << " GB/s, in place " << bytes / inPlaceNs << " GB/s\n";
+}
+
+// The same loops through at(), which always checks, and through row
+// pointers, which never do; the gap is what MATRIX_CHECKED=0 buys. The size
+// is a run-time value so the compiler cannot prove the checks away. The
+// row-pointer multiply only vectorizes where the compiler will version the
+// loop for aliasing (-O3 with GCC).
+void benchmarkChecking(size_t n) {
+    DynamicMatrix<> a(n, n), b(n, n), c(n, n);
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < n; ++j) {
+            a(i, j) = 1.0 / (i + j + 1);
+            b(i, j) = static_cast<double>(i % 7) - static_cast<double>(j % 5);
+        }
+    }
+
+    double checkedMultiply = timeNs([&] {
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t j = 0; j < n; ++j) c.at(i, j) = 0;
+            for (size_t k = 0; k < n; ++k) {
+                for (size_t j = 0; j < n; ++j) c.at(i, j) += a.at(i, k) * b.at(k, j);
+            }
+        }
+    });
+    double rawMultiply = timeNs([&] {
+        for (size_t i = 0; i < n; ++i) {
+            double* out = c.row(i);
+            for (size_t j = 0; j < n; ++j) out[j] = 0;
+            for (size_t k = 0; k < n; ++k) {
+                const double aik = a.row(i)[k];
+                const double* in = b.row(k);
+                for (size_t j = 0; j < n; ++j) out[j] += aik * in[j];
+            }
+        }
+    });
+    double checkedTranspose = timeNs([&] {
+        for (int r = 0; r < 20; ++r) {
+            for (size_t i = 0; i < n; ++i) {
+                for (size_t j = 0; j < n; ++j) c.at(j, i) = a.at(i, j);
+            }
+        }
+    }) / 20;
+    double rawTranspose = timeNs([&] {
+        for (int r = 0; r < 20; ++r) {
+            for (size_t i = 0; i < n; ++i) {
+                const double* in = a.row(i);
+                for (size_t j = 0; j < n; ++j) c.row(j)[i] = in[j];
+            }
+        }
+    }) / 20;
+    benchmarkSink = trace(c);
+
+    std::cout << "  i-k-j multiply: at() " << checkedMultiply / 1e6 << " ms, row pointers "
+              << rawMultiply / 1e6 << " ms (x" << checkedMultiply / rawMultiply << ")\n";
+    std::cout << "  transpose:      at() " << checkedTranspose / 1e3 << " us, row pointers "
+              << rawTranspose / 1e3 << " us (x" << checkedTranspose / rawTranspose << ")\n";
+}
+
+// Round-trips an n x n matrix of doubles through every storage path, and
+// through iostreams as the element-at-a-time baseline.
+void benchmarkStorage(size_t n) {
+    DynamicMatrix<> a(n, n);
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < n; ++j) {
+            a(i, j) = (static_cast<double>(i) * 1.5 - j) / 7.0;
+        }
+    }
+    const std::string base = (std::filesystem::temp_directory_path() / "matrix_bench").string();
+    const std::string binPath = base + ".bin";
+    const std::string textPath = base + ".txt";
+    const double bytes = n * n * sizeof(double);
+
+    double saveBinNs = timeNs([&] { saveBinary(binPath, a); });
+    double loadBinNs = timeNs([&] { benchmarkSink = trace(loadBinary<double>(binPath)); });
+    double mapNs = timeNs([&] { benchmarkSink = trace(MappedMatrix<double>(binPath)); });
+    double saveTextNs = timeNs([&] { saveText(textPath, a); });
+    double loadTextNs = timeNs([&] { benchmarkSink = trace(loadText<double>(textPath)); });
+    double streamOutNs = timeNs([&] {
+        std::ofstream out(textPath);
+        out.precision(17);
+        out << n << ' ' << n << '\n';
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t j = 0; j < n; ++j) out << a(i, j) << ' ';
+            out << '\n';
+        }
+    });
+    double streamInNs = timeNs([&] {
+        std::ifstream in(textPath);
+        size_t rows, cols;
+        in >> rows >> cols;
+        DynamicMatrix<> b(rows, cols);
+        for (size_t i = 0; i < rows; ++i) {
+            for (size_t j = 0; j < cols; ++j) in >> b(i, j);
+        }
+        benchmarkSink = trace(b);
+    });
+    std::filesystem::remove(binPath);
+    std::filesystem::remove(textPath);
+
+    std::cout << "  binary: save " << bytes / saveBinNs << " GB/s, load " << bytes / loadBinNs
+              << " GB/s, map + trace " << mapNs / 1e3 << " us\n";
+    std::cout << "  text:   save " << saveTextNs / 1e6 << " ms, load " << loadTextNs / 1e6 << " ms (to_chars/from_chars)\n";
+    std::cout << "  text:   save " << streamOutNs / 1e6 << " ms, load " << streamInNs / 1e6 << " ms (iostreams)\n";
+}
+
+// One line of the regression suite. Names are op/type/shape and stay stable
+// across runs so results can be matched against a baseline.
+struct SuiteResult {
+    std::string name;
+    double nsPerOp;
+    double flopsPerOp;
+    double bytesPerOp;
+    double allocsPerOp;
+    double noisePct;
 };
 
-template <size_t R1, size_t C1, size_t C2, typename T>
-Matrix<R1, C2, T> operator*(const Matrix<R1, C1, T>& lhs, const Matrix<C1, C2, T>& rhs) {
-    Matrix<R1, C2, T> result;
-    for (size_t i = 0; i < R1; ++i) {
-        for (size_t j = 0; j < C2; ++j) {
-            T sum{};
-            for (size_t k = 0; k < C1; ++k) {
-                sum += lhs(i, k) * rhs(k, j);
+struct BaselineEntry {
+    double nsPerOp;
+    double noisePct;
+};
+
+// Fewer passes than this cannot tell noise from a slowdown, so such runs
+// report against the baseline but never fail.
+const int SUITE_MIN_GATE_REPEATS = 3;
+
+struct SuiteOptions {
+    std::map<std::string, BaselineEntry> baseline;
+    double tolerance = 10;
+    int repeats = 5;
+    int retries = 3;
+    // Noise assumed for a run whose measured spread is smaller, which is
+    // always the case for a single pass.
+    double noiseFloor = 5;
+    // Scale every limit by the median slowdown against the baseline.
+    bool normalizeMachine = false;
+    // When not empty, only these results are measured.
+    std::set<std::string> only;
+};
+
+// How much slower than baseline a result may be before it counts as a
+// regression: the tolerance plus the noise seen in both runs, each at least
+// the noise floor. machineShift is 1 unless --normalize-machine asked for
+// the median slowdown.
+double regressionLimitPct(const SuiteOptions& options, const BaselineEntry& baseline, double noisePct, double machineShift) {
+    double noise = std::max(options.noiseFloor, baseline.noisePct) + std::max(options.noiseFloor, noisePct);
+    return ((1 + (options.tolerance + noise) / 100) * machineShift - 1) * 100;
+}
+
+// Calibrates a batch to at least 20 ms, then keeps the fastest of three
+// batches to damp scheduling noise.
+template <typename F>
+void measure(const SuiteOptions& options, std::vector<SuiteResult>& results, const std::string& name, double flops,
+             double bytes, F&& op) {
+    if (!options.only.empty() && !options.only.count(name)) return;
+    size_t reps = 1;
+    while (reps < (size_t(1) << 24) && timeNs([&] { for (size_t r = 0; r < reps; ++r) op(); }) < 2e7) {
+        reps *= 2;
+    }
+    double best = std::numeric_limits<double>::max();
+    long long allocs = 0;
+    for (int batch = 0; batch < 3; ++batch) {
+        long long allocsBefore = heapAllocations;
+        best = std::min(best, timeNs([&] { for (size_t r = 0; r < reps; ++r) op(); }) / reps);
+        allocs = heapAllocations - allocsBefore;
+    }
+    results.push_back({name, best, flops, bytes, static_cast<double>(allocs) / reps, 0});
+}
+
+// Sweeps the public operators over shapes (A is m x k, B is k x n) for one
+// element type. Bytes count each operand read and each result written once.
+template <typename T>
+void suiteForType(const SuiteOptions& options, const std::string& type, std::vector<SuiteResult>& results) {
+    const size_t shapes[][3] = {{16, 16, 16}, {64, 64, 64}, {256, 256, 256}, {1024, 1024, 1024}, {1024, 64, 1024}, {64, 1024, 64}};
+    for (const auto& shape : shapes) {
+        const size_t m = shape[0], k = shape[1], n = shape[2];
+        DynamicMatrix<T> a(m, k), a2(m, k), b(k, n);
+        for (size_t i = 0; i < m; ++i) {
+            for (size_t j = 0; j < k; ++j) {
+                a(i, j) = static_cast<T>(static_cast<int>((i * 7 + j) % 10) - 5);
+                a2(i, j) = static_cast<T>(static_cast<int>((i + j * 3) % 10) - 5);
+            }
+        }
+        for (size_t i = 0; i < k; ++i) {
+            for (size_t j = 0; j < n; ++j) {
+                b(i, j) = static_cast<T>(static_cast<int>((i * 3 + j) % 10) - 5);
             }
-            result(i, j) = sum;
         }
+
+        const std::string mk = std::to_string(m) + "x" + std::to_string(k);
+        const double elementsA = static_cast<double>(m * k);
+        T sink{};
+        measure(options, results, "add/" + type + "/" + mk, elementsA, 3 * elementsA * sizeof(T), [&] {
+            auto c = a + a2;
+            sink += c.data()[0];
+        });
+        measure(options, results, "multiply/" + type + "/" + mk + "x" + std::to_string(n), 2.0 * m * k * n,
+                (elementsA + static_cast<double>(k * n) + static_cast<double>(m * n)) * sizeof(T), [&] {
+            auto c = a * b;
+            sink += c.data()[0];
+        });
+        measure(options, results, "transpose/" + type + "/" + mk, 0, 2 * elementsA * sizeof(T), [&] {
+            auto c = transpose(a);
+            sink += c.data()[0];
+        });
+        if (m == k) {
+            measure(options, results, "trace/" + type + "/" + mk, static_cast<double>(m), static_cast<double>(m) * sizeof(T),
+                    [&] { sink += trace(a); });
+        }
+        benchmarkSink = static_cast<double>(sink);
     }
-    return result;
 }
 
-template <size_t Rows, size_t Cols, typename T>
-auto transpose(Matrix<Rows, Cols, T>&& mat) {
-    Matrix<Cols, Rows, T> result;
-    for (size_t i = 0; i < Rows; ++i) {
-        for (size_t j = 0; j < Cols; ++j) {
-            result(j, i) = std::forward<Matrix<Rows, Cols, T>>(mat)(i, j);
+// The fixed-size Matrix operators for one N x N shape: inline storage,
+// the fused expression path and the unrolled small product all show up
+// here rather than in the DynamicMatrix sweep.
+template <typename T, size_t N>
+void suiteForFixed(const SuiteOptions& options, const std::string& type, std::vector<SuiteResult>& results) {
+    Matrix<N, N, T> a, a2, b;
+    for (size_t i = 0; i < N; ++i) {
+        for (size_t j = 0; j < N; ++j) {
+            a(i, j) = static_cast<T>(static_cast<int>((i * 7 + j) % 10) - 5);
+            a2(i, j) = static_cast<T>(static_cast<int>((i + j * 3) % 10) - 5);
+            b(i, j) = static_cast<T>(static_cast<int>((i * 3 + j) % 10) - 5);
         }
     }
-    return result;
+
+    const std::string shape = std::to_string(N) + "x" + std::to_string(N);
+    const double elements = static_cast<double>(N * N);
+    double sink = 0;
+    measure(options, results, "add/" + type + "/" + shape, elements, 3 * elements * sizeof(T), [&] {
+        Matrix<N, N, T> c = a + a2;
+        sink += static_cast<double>(c.data()[0]);
+    });
+    measure(options, results, "multiply/" + type + "/" + shape + "x" + std::to_string(N), 2.0 * N * N * N,
+            3 * elements * sizeof(T), [&] {
+        Matrix<N, N, T> c = a * b;
+        sink += static_cast<double>(c.data()[0]);
+    });
+    measure(options, results, "transpose/" + type + "/" + shape, 0, 2 * elements * sizeof(T), [&] {
+        Matrix<N, N, T> c = transpose(a);
+        sink += static_cast<double>(c.data()[0]);
+    });
+    measure(options, results, "trace/" + type + "/" + shape, static_cast<double>(N), static_cast<double>(N) * sizeof(T),
+            [&] { sink += static_cast<double>(trace(a)); });
+    // One product, then a single fused pass for the sum, difference and
+    // transpose.
+    measure(options, results, "chain/" + type + "/" + shape, 2.0 * N * N * N + 2 * elements,
+            5 * elements * sizeof(T), [&] {
+        a2(0, 0) = static_cast<T>(1) - a2(0, 0);
+        sink += static_cast<double>(trace(transpose(a * b + a2 - a)));
+    });
+    benchmarkSink = sink;
 }
 
-// Replacing lambda with a function template for trace
-template <size_t N, typename T>
-T trace(const Matrix<N, N, T>& mat) {
-    T trace{};
+template <typename T, size_t... Ns>
+void suiteForFixedShapes(const SuiteOptions& options, const std::string& type, std::vector<SuiteResult>& results) {
+    (suiteForFixed<T, Ns>(options, type, results), ...);
+}
+
+// Reads the name, ns_per_op and noise_pct of every result line of a suite
+// JSON file. Files written before noise_pct existed read as noise-free.
+std::map<std::string, BaselineEntry> loadBaseline(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) throw std::runtime_error("cannot open " + path);
+    std::map<std::string, BaselineEntry> baseline;
+    std::string line;
+    const std::string nameKey = "\"name\": \"";
+    const std::string nsKey = "\"ns_per_op\": ";
+    const std::string noiseKey = "\"noise_pct\": ";
+    while (std::getline(in, line)) {
+        size_t name = line.find(nameKey);
+        size_t ns = line.find(nsKey);
+        if (name == std::string::npos || ns == std::string::npos) continue;
+        size_t noise = line.find(noiseKey);
+        name += nameKey.size();
+        baseline[line.substr(name, line.find('"', name) - name)] = {
+            std::strtod(line.c_str() + ns + nsKey.size(), nullptr),
+            noise == std::string::npos ? 0 : std::strtod(line.c_str() + noise + noiseKey.size(), nullptr)};
+    }
+    return baseline;
+}
+
+void writeSuiteJson(const std::string& path, const std::vector<SuiteResult>& results) {
+    std::ofstream out(path);
+    if (!out) throw std::runtime_error("cannot open " + path);
+    out.precision(6);
+    out << "{\n  \"threads\": " << MatrixThreadPool::instance().threads()
+        << ",\n  \"gemm_kernel\": \"" << gemmIsaName(detectGemmIsa()) << "\",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const SuiteResult& r = results[i];
+        out << "    {\"name\": \"" << r.name << "\", \"ns_per_op\": " << r.nsPerOp
+            << ", \"gflops\": " << r.flopsPerOp / r.nsPerOp << ", \"bytes_per_op\": " << r.bytesPerOp
+            << ", \"allocs_per_op\": " << r.allocsPerOp << ", \"noise_pct\": " << r.noisePct << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+// One pass of the sweep, run in a fresh process: each process gets its own
+// address layout, and where buffers land relative to each other moves
+// results by tens of percent, more than anything within one process.
+// Only the named results are measured when only is not empty.
+std::vector<SuiteResult> runSuitePass(const std::set<std::string>& only) {
+    char exe[4096];
+    ssize_t length = ::readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (length <= 0) throw std::runtime_error("cannot locate /proc/self/exe");
+    exe[length] = '\0';
+    std::string command = std::string("'") + exe + "' --suite --pass";
+    if (!only.empty()) {
+        const char* separator = " --only ";
+        for (const std::string& name : only) {
+            command += separator + name;
+            separator = ",";
+        }
+    }
+    FILE* pipe = ::popen(command.c_str(), "r");
+    if (!pipe) throw std::runtime_error("cannot run " + command);
+    std::vector<SuiteResult> results;
+    char name[256];
+    double ns, flops, bytes, allocs;
+    while (std::fscanf(pipe, "%255s %lf %lf %lf %lf", name, &ns, &flops, &bytes, &allocs) == 5) {
+        results.push_back({name, ns, flops, bytes, allocs, 0});
+    }
+    if (::pclose(pipe) != 0) throw std::runtime_error("suite pass failed");
+    return results;
+}
+
+// --suite [--json FILE] [--baseline FILE] [--tolerance PERCENT] [--repeat N]
+//         [--noise-floor PERCENT] [--normalize-machine] [--only NAME,...]
+// Runs the sweep N times (5 by default), each in its own process, and keeps
+// the fastest time of each result; the median's distance from it is the
+// noise. --only restricts the sweep to the named results. Optionally writes
+// the results as JSON and compares them against a baseline written by an
+// earlier run. A result fails when its fastest time exceeds the baseline by
+// more than the tolerance (10% by default) plus the noise of both runs,
+// each counted as at least the noise floor (5% by default). Failing
+// results are re-measured in up to three more rounds of N passes; 1 is
+// returned if any still fail. With fewer than three passes nothing fails.
+// --normalize-machine also scales each limit by the median slowdown over
+// all results.
+int runSuite(int argc, char* argv[]) {
+    std::string jsonPath, baselinePath;
+    SuiteOptions options;
+    bool pass = false;
+    for (int i = 0; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 < argc && arg == "--json") {
+            jsonPath = argv[++i];
+        } else if (i + 1 < argc && arg == "--baseline") {
+            baselinePath = argv[++i];
+        } else if (i + 1 < argc && arg == "--tolerance") {
+            options.tolerance = std::atof(argv[++i]);
+        } else if (i + 1 < argc && arg == "--noise-floor") {
+            options.noiseFloor = std::max(0.0, std::atof(argv[++i]));
+        } else if (i + 1 < argc && arg == "--repeat") {
+            options.repeats = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--normalize-machine") {
+            options.normalizeMachine = true;
+        } else if (arg == "--pass") {
+            pass = true;
+        } else if (i + 1 < argc && arg == "--only") {
+            std::string list = argv[++i];
+            for (size_t begin = 0, end; begin <= list.size(); begin = end + 1) {
+                end = std::min(list.find(',', begin), list.size());
+                options.only.insert(list.substr(begin, end - begin));
+            }
+        } else {
+            throw std::invalid_argument("unknown suite option " + arg);
+        }
+    }
+
+    // A pass prints one raw sample per result for runSuitePass to read.
+    if (pass) {
+        std::vector<SuiteResult> results;
+        suiteForType<float>(options, "float", results);
+        suiteForType<double>(options, "double", results);
+        suiteForType<int>(options, "int", results);
+        suiteForFixedShapes<float, 2, 4, 8, 16, 64, 256>(options, "fixed-float", results);
+        suiteForFixedShapes<double, 2, 4, 8, 16, 64, 256>(options, "fixed-double", results);
+        suiteForFixedShapes<int, 2, 4, 8, 16, 64, 256>(options, "fixed-int", results);
+        for (const SuiteResult& r : results) {
+            std::printf("%s %.17g %.17g %.17g %.17g\n", r.name.c_str(), r.nsPerOp, r.flopsPerOp, r.bytesPerOp,
+                        r.allocsPerOp);
+        }
+        return 0;
+    }
+
+    if (!baselinePath.empty()) options.baseline = loadBaseline(baselinePath);
+    const std::map<std::string, BaselineEntry>& baseline = options.baseline;
+
+    std::map<std::string, std::vector<double>> samples;
+    auto sweep = [&](const std::set<std::string>& only) {
+        std::vector<SuiteResult> results = runSuitePass(only);
+        for (const SuiteResult& r : results) {
+            samples[r.name].push_back(r.nsPerOp);
+        }
+        return results;
+    };
+    auto summarize = [&](SuiteResult& r) {
+        std::vector<double>& times = samples[r.name];
+        std::sort(times.begin(), times.end());
+        r.nsPerOp = times.front();
+        r.noisePct = (times[times.size() / 2] / times.front() - 1) * 100;
+    };
+    // With --normalize-machine, the median ratio to baseline over all
+    // results, if above 1. This hides any regression that slows most
+    // results, so it is off unless asked for and always reported.
+    double machineShift = 1;
+    auto updateShift = [&](const std::vector<SuiteResult>& results) {
+        if (!options.normalizeMachine) return;
+        std::vector<double> ratios;
+        for (const SuiteResult& r : results) {
+            auto it = baseline.find(r.name);
+            if (it != baseline.end()) ratios.push_back(r.nsPerOp / it->second.nsPerOp);
+        }
+        if (ratios.empty()) return;
+        std::nth_element(ratios.begin(), ratios.begin() + ratios.size() / 2, ratios.end());
+        machineShift = std::max(1.0, ratios[ratios.size() / 2]);
+    };
+    auto exceedsLimit = [&](const SuiteResult& r) {
+        auto it = baseline.find(r.name);
+        return it != baseline.end() && (r.nsPerOp / it->second.nsPerOp - 1) * 100 >
+                                           regressionLimitPct(options, it->second, r.noisePct, machineShift);
+    };
+
+    // Results still past their limit get further passes of their own, up
+    // to options.retries rounds of N; a real slowdown shows up every time.
+    std::vector<SuiteResult> results = sweep(options.only);
+    for (int i = 1; i < options.repeats; ++i) {
+        sweep(options.only);
+    }
+    for (SuiteResult& r : results) {
+        summarize(r);
+    }
+    updateShift(results);
+    const bool gating = options.repeats >= SUITE_MIN_GATE_REPEATS;
+    for (int retry = 0; gating && retry < options.retries; ++retry) {
+        std::set<std::string> flagged;
+        for (const SuiteResult& r : results) {
+            if (exceedsLimit(r)) flagged.insert(r.name);
+        }
+        if (flagged.empty()) break;
+        for (int i = 0; i < options.repeats; ++i) {
+            sweep(flagged);
+        }
+        for (SuiteResult& r : results) {
+            if (flagged.count(r.name)) summarize(r);
+        }
+        updateShift(results);
+    }
+    if (!jsonPath.empty()) writeSuiteJson(jsonPath, results);
+
+    if (!baseline.empty() && options.normalizeMachine) {
+        std::cout << "Limits scaled by " << machineShift << ", the median slowdown against the baseline run\n";
+    }
+    int regressions = 0;
+    for (const SuiteResult& r : results) {
+        std::cout << "  " << r.name << ": " << r.nsPerOp << " ns/op, " << r.flopsPerOp / r.nsPerOp << " GFLOP/s, "
+                  << r.bytesPerOp / r.nsPerOp << " GB/s, " << r.allocsPerOp << " allocations/op, noise +" << r.noisePct << "%";
+        auto it = baseline.find(r.name);
+        if (it != baseline.end()) {
+            double change = (r.nsPerOp / it->second.nsPerOp - 1) * 100;
+            std::cout << ", " << (change >= 0 ? "+" : "") << change << "% vs baseline (limit +"
+                      << regressionLimitPct(options, it->second, r.noisePct, machineShift) << "%)";
+            if (exceedsLimit(r)) {
+                std::cout << (gating ? " REGRESSION" : " over limit");
+                ++regressions;
+            }
+        }
+        std::cout << "\n";
+    }
+    if (!baseline.empty() && !gating) {
+        std::cout << regressions << " result(s) over their limit; not failing, since " << options.repeats
+                  << " pass(es) cannot measure noise (use --repeat " << SUITE_MIN_GATE_REPEATS << " or more)\n";
+        return 0;
+    }
+    if (!baseline.empty()) {
+        std::cout << regressions << " regression(s) beyond " << options.tolerance << "% plus noise\n";
+    }
+    return regressions > 0 ? 1 : 0;
+}
+
+// Blocked LU against the same algorithm run unblocked over the whole
+// matrix, plus a solve with one right-hand side.
+void benchmarkLU(size_t n) {
+    DynamicMatrix<> a(n, n), rhs(n, 1);
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<double> dist(-1, 1);
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < n; ++j) a(i, j) = dist(rng);
+        rhs(i, 0) = dist(rng);
+    }
+
+    std::vector<size_t> pivots(n);
+    DynamicMatrix<> work = a;
+    double naiveNs = timeNs([&] { luUnblocked(n, n, work.data(), work.stride(), pivots.data()); });
+    work = a;
+    double blockedNs = timeNs([&] { luBlocked(n, work.data(), work.stride(), pivots.data()); });
+    LUDecomposition<DynamicMatrix<>> lu(a);
+    double solveNs = timeNs([&] { benchmarkSink = lu.solve(rhs)(0, 0); });
+
+    const double flops = 2.0 / 3.0 * n * n * n;
+    std::cout << "  " << n << "x" << n << ": unblocked " << flops / naiveNs << " GFLOP/s, blocked "
+              << flops / blockedNs << " GFLOP/s, solve " << solveNs / 1e3 << " us\n";
+}
+
+template <size_t N>
+void benchmarkTinyDet(int rounds) {
+    Matrix<N, N> a;
     for (size_t i = 0; i < N; ++i) {
-        trace += mat(i, i);
+        for (size_t j = 0; j < N; ++j) a(i, j) = 1.0 / (i + 2 * j + 1);
     }
-    return trace;
+    double sink = 0;
+    double closedNs = timeNs([&] {
+        for (int r = 0; r < rounds; ++r) {
+            a(0, 0) = r;
+            sink += det(a);
+        }
+    });
+    double luNs = timeNs([&] {
+        for (int r = 0; r < rounds; ++r) {
+            a(0, 0) = r;
+            sink += LUDecomposition<Matrix<N, N>>(a).determinant();
+        }
+    });
+    benchmarkSink = sink;
+    std::cout << "  det " << N << "x" << N << ": closed form " << closedNs / rounds << " ns, LU " << luNs / rounds << " ns\n";
 }
 
-Matrix<2, 2> createSquareMatrix(const std::string& name) {
-    Matrix<2, 2> mat;
-    std::cout << "Enter values for 2x2 matrix " << name << " (row-wise):\n";
-    for (size_t i = 0; i < 2; ++i) {
-        for (size_t j = 0; j < 2; ++j) {
-            std::cout << "Enter value for [" << i << "][" << j << "]: ";
-            while (!(std::cin >> mat(i, j))) {
-                std::cin.clear();
-                std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-                std::cout << "Invalid input. Please enter a number: ";
+// A = n x n with the given fraction of zeros, times a dense n x 64 block and
+// times a vector, against the dense kernels on the same data.
+void benchmarkSparse(size_t n, double sparsity) {
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<double> dist(0, 1);
+    DynamicMatrix<> a(n, n), b(n, 64), x(n, 1);
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < n; ++j) {
+            if (dist(rng) >= sparsity) a(i, j) = dist(rng);
+        }
+        for (size_t j = 0; j < 64; ++j) b(i, j) = dist(rng);
+        x(i, 0) = dist(rng);
+    }
+    SparseMatrix<> s(a);
+    std::vector<double> xv(x.data(), x.data() + n);
+
+    double denseNs = timeNs([&] { benchmarkSink = (a * b)(0, 0); });
+    double sparseNs = timeNs([&] { benchmarkSink = (s * b)(0, 0); });
+    double denseVecNs = timeNs([&] {
+        for (int r = 0; r < 10; ++r) benchmarkSink = (a * x)(0, 0);
+    }) / 10;
+    double sparseVecNs = timeNs([&] {
+        for (int r = 0; r < 10; ++r) benchmarkSink = (s * xv)[0];
+    }) / 10;
+
+    std::cout << "  " << sparsity * 100 << "% zeros: x dense " << denseNs / 1e3 << " us dense, " << sparseNs / 1e3
+              << " us CSR; x vector " << denseVecNs / 1e3 << " us dense, " << sparseVecNs / 1e3 << " us CSR; "
+              << n * a.stride() * sizeof(double) / 1e6 << " MB dense, " << s.memory_bytes() / 1e6 << " MB CSR\n";
+}
+
+// Reference C = A * B with the plain triple loop.
+template <typename T>
+std::vector<T> naiveProduct(size_t m, size_t n, size_t k, const std::vector<T>& a, const std::vector<T>& b) {
+    std::vector<T> c(m * n, T{});
+    for (size_t i = 0; i < m; ++i) {
+        for (size_t p = 0; p < k; ++p) {
+            for (size_t j = 0; j < n; ++j) {
+                c[i * n + j] += a[i * k + p] * b[p * n + j];
             }
         }
     }
-    return mat;
+    return c;
 }
 
-Matrix<2, 3> create2x3Matrix(const std::string& name) {
-    Matrix<2, 3> mat;
-    std::cout << "Enter values for 2x3 matrix " << name << " (row-wise):\n";
-    for (size_t i = 0; i < 2; ++i) {
-        for (size_t j = 0; j < 3; ++j) {
-            std::cout << "Enter value for [" << i << "][" << j << "]: ";
-            while (!(std::cin >> mat(i, j))) {
-                std::cin.clear();
-                std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-                std::cout << "Invalid input. Please enter a number: ";
+// Small integers keep every product and sum exact, so results must match
+// the reference bit for bit.
+template <typename T>
+std::vector<T> smallIntegers(size_t count, std::mt19937& rng) {
+    std::vector<T> values(count);
+    for (T& v : values) v = static_cast<T>(static_cast<int>(rng() % 11) - 5);
+    return values;
+}
+
+// Shapes around the edges of the blocking: single rows and columns, sizes
+// that are not multiples of MR/NR, and k, m and n just past KC, MC and NC.
+const size_t GEMM_CHECK_SHAPES[][3] = {
+    {1, 1, 1}, {1, 37, 1}, {1, 300, 19}, {23, 300, 1}, {23, 1, 17}, {5, 7, 3}, {6, 8, 16},
+    {7, 9, 17}, {13, 257, 29}, {97, 31, 33}, {100, 260, 45}, {9, 5, 1025}, {3, 4, 2049}, {2, 3, 4097},
+};
+
+// Runs gemmBlocked with Kernel on every check shape, with leading
+// dimensions wider than the rows so padding must be left alone.
+template <typename Kernel, typename T>
+bool checkGemmKernel() {
+    std::mt19937 rng(11);
+    for (const auto& shape : GEMM_CHECK_SHAPES) {
+        const size_t m = shape[0], k = shape[1], n = shape[2];
+        const size_t lda = k + 3, ldb = n + 5, ldc = n + 2;
+        std::vector<T> a = smallIntegers<T>(m * k, rng), b = smallIntegers<T>(k * n, rng);
+        std::vector<T> paddedA(m * lda, T{7}), paddedB(k * ldb, T{7}), c(m * ldc, T{-1});
+        for (size_t i = 0; i < m; ++i) std::copy(&a[i * k], &a[i * k] + k, &paddedA[i * lda]);
+        for (size_t i = 0; i < k; ++i) std::copy(&b[i * n], &b[i * n] + n, &paddedB[i * ldb]);
+
+        gemmBlocked<Kernel>(m, n, k, paddedA.data(), lda, paddedB.data(), ldb, c.data(), ldc);
+        std::vector<T> expected = naiveProduct(m, n, k, a, b);
+        for (size_t i = 0; i < m; ++i) {
+            for (size_t j = 0; j < ldc; ++j) {
+                if (c[i * ldc + j] != (j < n ? expected[i * n + j] : T{-1})) return false;
             }
         }
     }
-    return mat;
+    return true;
 }
 
-Matrix<3, 2> create3x2Matrix(const std::string& name) {
-    Matrix<3, 2> mat;
-    std::cout << "Enter values for 3x2 matrix " << name << " (row-wise):\n";
-    for (size_t i = 0; i < 3; ++i) {
-        for (size_t j = 0; j < 2; ++j) {
-            std::cout << "Enter value for [" << i << "][" << j << "]: ";
-            while (!(std::cin >> mat(i, j))) {
-                std::cin.clear();
-                std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-                std::cout << "Invalid input. Please enter a number: ";
+// The public products: gemm's dispatch and thread split, DynamicMatrix and
+// the fixed-size Matrix, including the unrolled small path.
+template <typename T>
+bool checkGemmDispatch() {
+    std::mt19937 rng(12);
+    for (const auto& shape : GEMM_CHECK_SHAPES) {
+        const size_t m = shape[0], k = shape[1], n = shape[2];
+        std::vector<T> a = smallIntegers<T>(m * k, rng), b = smallIntegers<T>(k * n, rng);
+        DynamicMatrix<T> da(m, k), db(k, n);
+        for (size_t i = 0; i < m; ++i) std::copy(&a[i * k], &a[i * k] + k, da.row(i));
+        for (size_t i = 0; i < k; ++i) std::copy(&b[i * n], &b[i * n] + n, db.row(i));
+        DynamicMatrix<T> dc = da * db;
+        std::vector<T> expected = naiveProduct(m, n, k, a, b);
+        for (size_t i = 0; i < m; ++i) {
+            if (!std::equal(dc.row(i), dc.row(i) + n, &expected[i * n])) return false;
+        }
+    }
+
+    Matrix<3, 5, T> a;
+    Matrix<5, 2, T> b;
+    Matrix<67, 33, T> c;
+    Matrix<33, 70, T> d;
+    std::vector<T> values = smallIntegers<T>(15 + 10 + 67 * 33 + 33 * 70, rng);
+    std::copy(&values[0], &values[15], a.data());
+    std::copy(&values[15], &values[25], b.data());
+    std::copy(&values[25], &values[25 + 67 * 33], c.data());
+    std::copy(&values[25 + 67 * 33], &values[0] + values.size(), d.data());
+    auto ab = a * b;
+    auto cd = c * d;
+    std::vector<T> expectedAb = naiveProduct(3, 2, 5, std::vector<T>(a.data(), a.data() + 15),
+                                             std::vector<T>(b.data(), b.data() + 10));
+    std::vector<T> expectedCd = naiveProduct(67, 70, 33, std::vector<T>(c.data(), c.data() + 67 * 33),
+                                             std::vector<T>(d.data(), d.data() + 33 * 70));
+    return std::equal(ab.data(), ab.data() + 6, expectedAb.begin()) &&
+           std::equal(cd.data(), cd.data() + 67 * 70, expectedCd.begin());
+}
+
+// ||A x - b|| relative to ||A|| ||x||, in units of the rounding error, for
+// sizes on both sides of the unblocked/blocked switch.
+bool checkLUResidual() {
+    std::mt19937 rng(13);
+    std::uniform_real_distribution<double> dist(-1, 1);
+    for (size_t n : {1, 2, 3, 5, 17, 64, 128, 129, 200, 300}) {
+        DynamicMatrix<> a(n, n), b(n, 2);
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t j = 0; j < n; ++j) a(i, j) = dist(rng);
+            b(i, 0) = dist(rng);
+            b(i, 1) = dist(rng);
+        }
+        DynamicMatrix<> x = solve(a, b);
+        DynamicMatrix<> ax = a * x;
+        double normA = 0, normX = 0, residual = 0;
+        for (size_t i = 0; i < n; ++i) {
+            double rowSum = 0;
+            for (size_t j = 0; j < n; ++j) rowSum += std::abs(a(i, j));
+            normA = std::max(normA, rowSum);
+            for (size_t j = 0; j < 2; ++j) {
+                normX = std::max(normX, std::abs(x(i, j)));
+                residual = std::max(residual, std::abs(ax(i, j) - b(i, j)));
             }
         }
+        if (residual > 100 * n * std::numeric_limits<double>::epsilon() * normA * normX) return false;
     }
-    return mat;
+
+    Matrix<5, 5> f;
+    for (size_t i = 0; i < 5; ++i) {
+        for (size_t j = 0; j < 5; ++j) f(i, j) = dist(rng) + (i == j ? 3 : 0);
+    }
+    Matrix<5, 5> identity = f * inverse(f);
+    for (size_t i = 0; i < 5; ++i) {
+        for (size_t j = 0; j < 5; ++j) {
+            if (std::abs(identity(i, j) - (i == j ? 1.0 : 0.0)) > 1e-12) return false;
+        }
+    }
+    return true;
+}
+
+// CSR products and transpose against the same operations on to_dense().
+bool checkSparseProducts() {
+    std::mt19937 rng(14);
+    const size_t shapes[][3] = {{1, 7, 4}, {7, 1, 3}, {37, 53, 9}, {64, 40, 1}, {5, 5, 5}};
+    for (const auto& shape : shapes) {
+        const size_t m = shape[0], k = shape[1], n = shape[2];
+        DynamicMatrix<> dense(m, k), rhs(k, n);
+        for (size_t i = 0; i < m; ++i) {
+            for (size_t j = 0; j < k; ++j) {
+                if (rng() % 5 == 0) dense(i, j) = static_cast<int>(rng() % 11) - 5;
+            }
+        }
+        for (size_t i = 0; i < k; ++i) {
+            for (size_t j = 0; j < n; ++j) rhs(i, j) = static_cast<int>(rng() % 11) - 5;
+        }
+        SparseMatrix<> sparse(dense);
+        DynamicMatrix<> expected = sparse.to_dense() * rhs;
+        DynamicMatrix<> product = sparse * rhs;
+        for (size_t i = 0; i < m; ++i) {
+            if (!std::equal(product.row(i), product.row(i) + n, expected.row(i))) return false;
+        }
+
+        std::vector<double> x(k);
+        for (size_t j = 0; j < k; ++j) x[j] = rhs(j, 0);
+        std::vector<double> y = sparse * x;
+        for (size_t i = 0; i < m; ++i) {
+            if (y[i] != expected(i, 0)) return false;
+        }
+
+        DynamicMatrix<> transposed = transpose(sparse).to_dense();
+        for (size_t i = 0; i < m; ++i) {
+            for (size_t j = 0; j < k; ++j) {
+                if (transposed(j, i) != dense(i, j)) return false;
+            }
+        }
+    }
+    return true;
+}
+
+// A chunk that throws, on the caller or on a worker, must reach the caller
+// only after every chunk has finished, and leave the pool usable.
+bool checkThreadPoolJobs(MatrixThreadPool& pool) {
+    const size_t n = 1000;
+    for (size_t throwAt : {size_t(0), n - 1}) {
+        std::atomic<unsigned> calls{0};
+        auto body = [&](size_t begin, size_t end) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(begin == 0 ? 0 : 20));
+            calls++;
+            if (begin <= throwAt && throwAt < end) throw std::runtime_error("chunk failed");
+        };
+        try {
+            pool.run(n, body);
+            return false;
+        } catch (const std::runtime_error&) {
+        }
+        if (calls != pool.threads()) return false;
+    }
+    std::atomic<unsigned> calls{0};
+    auto body = [&](size_t, size_t) { calls++; };
+    return pool.run(n, body) && calls == pool.threads();
+}
+
+// Runs on at least four threads so workers take part even on one core.
+bool checkThreadPoolExceptions() {
+    MatrixThreadPool& pool = MatrixThreadPool::instance();
+    const unsigned threads = pool.threads();
+    pool.set_threads(std::max(4u, threads));
+    bool passed = checkThreadPoolJobs(pool);
+    pool.set_threads(threads);
+    return passed;
+}
+
+// Quick correctness checks; returns the number of failures. SIMD kernels
+// the CPU lacks are skipped.
+int runChecks() {
+    struct Check {
+        const char* name;
+        bool (*run)();
+    };
+    std::vector<Check> checks = {
+        {"portable gemm kernel, double", checkGemmKernel<PortableKernel<double>, double>},
+        {"portable gemm kernel, float", checkGemmKernel<PortableKernel<float>, float>},
+        {"portable gemm kernel, int", checkGemmKernel<PortableKernel<int>, int>},
+    };
+#ifdef MATRIX_X86_SIMD
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        checks.push_back({"AVX2 gemm kernel, double", checkGemmKernel<Avx2Kernel, double>});
+        checks.push_back({"AVX2 gemm kernel, float", checkGemmKernel<Avx2FloatKernel, float>});
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+        checks.push_back({"AVX-512 gemm kernel, double", checkGemmKernel<Avx512Kernel, double>});
+        checks.push_back({"AVX-512 gemm kernel, float", checkGemmKernel<Avx512FloatKernel, float>});
+    }
+#endif
+    checks.push_back({"Matrix and DynamicMatrix products, double", checkGemmDispatch<double>});
+    checks.push_back({"Matrix and DynamicMatrix products, float", checkGemmDispatch<float>});
+    checks.push_back({"Matrix and DynamicMatrix products, int", checkGemmDispatch<int>});
+    checks.push_back({"LU solve residual", checkLUResidual});
+    checks.push_back({"CSR products and transpose", checkSparseProducts});
+    checks.push_back({"thread pool rethrows after every chunk finishes", checkThreadPoolExceptions});
+    int failures = 0;
+    for (const Check& check : checks) {
+        bool passed = check.run();
+        std::cout << (passed ? "ok   " : "FAIL ") << check.name << "\n";
+        if (!passed) ++failures;
+    }
+    return failures;
+}
+
+void runBenchmarks() {
+    if (!heapAllocationsCounted) {
+        std::cout << "(heap allocations read 0: build with -DBENCH_COUNT_ALLOCATIONS to count them)\n";
+    }
+    const int rounds = 1000000;
+    std::cout << "trace(transpose(A * B + C - A)), inline threshold " << MATRIX_INLINE_BYTES << " bytes:\n";
+    benchmarkSmallChain<2>(rounds);
+    benchmarkSmallChain<3>(rounds);
+    benchmarkSmallChain<4>(rounds);
+    benchmarkSmallChain<6>(rounds / 4);
+    benchmarkSmallChain<8>(rounds / 8);
+
+    std::cout << "D = A + B - C + 2A:\n";
+    benchmarkFusion<64>(2000);
+    benchmarkFusion<512>(50);
+    benchmarkFusion<1024>(10);
+
+    std::cout << "Square multiply, double, " << gemmIsaName(detectGemmIsa()) << " kernel:\n";
+    benchmarkMultiply<16>(true);
+    benchmarkMultiply<32>(true);
+    benchmarkMultiply<64>(true);
+    benchmarkMultiply<128>(true);
+    benchmarkMultiply<256>(true);
+    benchmarkMultiply<512>(true);
+    benchmarkMultiply<1024>(true);
+    benchmarkMultiply<2048>(false);
+
+    std::cout << "Checked against unchecked access, 256x256 double (MATRIX_CHECKED=" << MATRIX_CHECKED << "):\n";
+    benchmarkChecking(256);
+
+    std::cout << "Transpose, double:\n";
+    benchmarkTranspose(64, 20000);
+    benchmarkTranspose(256, 1000);
+    benchmarkTranspose(1000, 50);
+    benchmarkTranspose(1024, 50);
+    benchmarkTranspose(2048, 10);
+    benchmarkTranspose(4096, 2);
+
+    std::cout << "LU with partial pivoting, double:\n";
+    benchmarkTinyDet<2>(1000000);
+    benchmarkTinyDet<3>(1000000);
+    benchmarkLU(128);
+    benchmarkLU(256);
+    benchmarkLU(512);
+    benchmarkLU(1024);
+
+    std::cout << "Sparse (CSR) against dense, 2000x2000 double:\n";
+    benchmarkSparse(2000, 0.5);
+    benchmarkSparse(2000, 0.9);
+    benchmarkSparse(2000, 0.95);
+    benchmarkSparse(2000, 0.99);
+    benchmarkSparse(2000, 0.999);
+
+    std::cout << "Storage, 1000x1000 double:\n";
+    benchmarkStorage(1000);
+
+    std::cout << "Thread scaling, 1024x1024 double:\n";
+    benchmarkScaling();
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "--bench") {
+        runBenchmarks();
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--check") {
+        return runChecks() == 0 ? 0 : 1;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--suite") {
+        try {
+            return runSuite(argc - 2, argv + 2);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 2;
+        }
+    }
+
     int choice;
     do {
         std::cout << "\nMatrix Operations Menu:\n";
@@ -176,19 +3028,20 @@ int main() {
         std::cout << "4. Transpose a 2x3 matrix\n";
         std::cout << "5. Calculate trace of 2x2 matrix\n";
         std::cout << "6. Exit\n";
+        std::cout << "7. Multiply matrices of any shape\n";
         std::cout << "Enter your choice: ";
 
-        while (!(std::cin >> choice) || choice < 1 || choice > 6) {
+        while (!(std::cin >> choice) || choice < 1 || choice > 7) {
             std::cin.clear();
             std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-            std::cout << "Invalid choice. Please enter 1-6: ";
+            std::cout << "Invalid choice. Please enter 1-7: ";
         }
 
         switch (choice) {
             case 1: {
                 auto m1 = create2x3Matrix("A");
                 auto m2 = create2x3Matrix("B");
-                auto sum = m1 + m2;
+                Matrix<2, 3> sum = m1 + m2;
                 std::cout << "\nResult of A + B:\n";
                 sum.print();
                 break;
@@ -196,7 +3049,7 @@ int main() {
             case 2: {
                 auto m1 = create2x3Matrix("A");
                 auto m2 = create2x3Matrix("B");
-                auto diff = m1 - m2;
+                Matrix<2, 3> diff = m1 - m2;
                 std::cout << "\nResult of A - B:\n";
                 diff.print();
                 break;
@@ -224,6 +3077,18 @@ int main() {
             case 6:
                 std::cout << "Exiting...\n";
                 break;
+            case 7: {
+                auto m1 = createDynamicMatrix("A");
+                auto m2 = createDynamicMatrix("B");
+                try {
+                    auto product = m1 * m2;
+                    std::cout << "\nResult of A * B:\n";
+                    product.print();
+                } catch (const std::invalid_argument& e) {
+                    std::cout << "\n" << e.what() << "\n";
+                }
+                break;
+            }
         }
     } while (choice != 6);
 
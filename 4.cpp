@@ -1,5 +1,17 @@
 #include <iostream>
 #include <utility>
+#include <string>
+#include <string_view>
+#include <sstream>
+#include <charconv>
+#include <limits>
+#include <type_traits>
+#include <chrono>
+
+// bufferedPrint hands its buffer to std::cout once it holds this many bytes.
+#ifndef PRINT_FLUSH_BYTES
+#define PRINT_FLUSH_BYTES (1 << 16)
+#endif
 
 void print() {
     std::cout << std::endl;
@@ -16,7 +28,133 @@ void print(T&& first, Args&&... args) {
     }
 }
 
-int main() {
+// Per-thread output buffer for bufferedPrint. Whole lines are written with
+// one std::cout.write, so lines from different threads never interleave.
+class PrintBuffer {
+public:
+    static PrintBuffer& local() {
+        thread_local PrintBuffer buffer;
+        return buffer;
+    }
+
+    std::string& text() { return data; }
+
+    void flush() {
+        if (!data.empty()) {
+            std::cout.write(data.data(), data.size());
+            std::cout.flush();
+            data.clear();
+        }
+    }
+
+    ~PrintBuffer() { flush(); }
+
+private:
+    PrintBuffer() { data.reserve(2 * PRINT_FLUSH_BYTES); }
+
+    std::string data;
+};
+
+template<typename T>
+constexpr bool isPrintString = std::is_convertible_v<const T&, std::string_view>;
+
+template<typename T>
+constexpr bool isPrintChar = std::is_same_v<T, char> || std::is_same_v<T, signed char> || std::is_same_v<T, unsigned char>;
+
+// Upper bound on the text of a T known at compile time; 0 when it depends
+// on the value. Floating point uses std::cout's default %g with precision 6.
+template<typename T>
+constexpr size_t printWidth() {
+    if constexpr (isPrintString<T>) {
+        return 0;
+    } else if constexpr (isPrintChar<T> || std::is_same_v<T, bool>) {
+        return 1;
+    } else if constexpr (std::is_integral_v<T>) {
+        return std::numeric_limits<T>::digits10 + 2;
+    } else if constexpr (std::is_floating_point_v<T>) {
+        return 16;
+    } else {
+        return 0;
+    }
+}
+
+template<typename T>
+size_t printLength(const T& value) {
+    if constexpr (isPrintString<T>) {
+        return std::string_view(value).size();
+    } else {
+        return 0;
+    }
+}
+
+template<typename T>
+void appendPrinted(std::string& out, const T& value) {
+    if constexpr (isPrintString<T>) {
+        out.append(std::string_view(value));
+    } else if constexpr (isPrintChar<T>) {
+        out.push_back(static_cast<char>(value));
+    } else if constexpr (std::is_same_v<T, bool>) {
+        out.push_back(value ? '1' : '0');
+    } else if constexpr (std::is_integral_v<T>) {
+        char digits[printWidth<T>()];
+        out.append(digits, std::to_chars(digits, digits + sizeof(digits), value).ptr);
+    } else if constexpr (std::is_floating_point_v<T>) {
+        char digits[printWidth<T>()];
+        out.append(digits, std::to_chars(digits, digits + sizeof(digits), value, std::chars_format::general, 6).ptr);
+    } else {
+        // Anything else goes through its operator<<.
+        thread_local std::ostringstream stream;
+        stream.str("");
+        stream << value;
+        out.append(stream.str());
+    }
+}
+
+// Same output as print, but formatted into the thread's PrintBuffer, sized
+// once per call, and only written out past PRINT_FLUSH_BYTES or on flushPrint.
+template<typename... Args>
+void bufferedPrint(const Args&... args) {
+    constexpr size_t fixed = (printWidth<std::decay_t<Args>>() + ... + 0) + (sizeof...(Args) > 0 ? sizeof...(Args) : 1);
+    std::string& out = PrintBuffer::local().text();
+    out.reserve(out.size() + fixed + (printLength(args) + ... + 0));
+    bool first = true;
+    ((first ? void(first = false) : out.push_back(' '), appendPrinted(out, args)), ...);
+    out.push_back('\n');
+    if (out.size() >= PRINT_FLUSH_BYTES) {
+        PrintBuffer::local().flush();
+    }
+}
+
+void flushPrint() {
+    PrintBuffer::local().flush();
+}
+
+// Lines go to stdout, rates to stderr: run as ./4 --bench > /dev/null.
+void runBenchmarks() {
+    const int lines = 1000000;
+    auto timeSeconds = [](auto&& f) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+    double printSeconds = timeSeconds([&] {
+        for (int i = 0; i < lines; ++i) print(i, i * 0.5, "line", 'x');
+    });
+    double bufferedSeconds = timeSeconds([&] {
+        for (int i = 0; i < lines; ++i) bufferedPrint(i, i * 0.5, "line", 'x');
+        flushPrint();
+    });
+    std::cerr << "print:         " << lines / printSeconds / 1e6 << " M lines/s\n";
+    std::cerr << "bufferedPrint: " << lines / bufferedSeconds / 1e6 << " M lines/s ("
+              << printSeconds / bufferedSeconds << "x)\n";
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "--bench") {
+        runBenchmarks();
+        return 0;
+    }
+
     print("Enter values to print:");
     print(1, 2.5, "hello", 'a');
     
@@ -0,0 +1,65 @@
+// Timing and heap-counting helpers shared by the --bench modes of the
+// Deque (1.cpp), Stack (2.cpp) and Matrix (3.cpp) programs.
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+
+static volatile double benchmarkSink;
+
+template<typename F>
+double timeNs(F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Global allocations since start-up. Only a build with
+// -DBENCH_COUNT_ALLOCATIONS replaces the allocation functions to count
+// them; otherwise the counter stays at zero and the interactive programs
+// keep the default allocator.
+static std::atomic<long long> heapAllocations{0};
+
+#ifdef BENCH_COUNT_ALLOCATIONS
+static const bool heapAllocationsCounted = true;
+
+// Kept out of line so GCC does not pair an inlined malloc()/free() with
+// the operator new/delete calls. The counter is atomic because worker
+// threads allocate too.
+[[gnu::noinline]] void* operator new(std::size_t size) {
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+[[gnu::noinline]] void operator delete(void* p, std::size_t) noexcept {
+    ::operator delete(p);
+}
+
+[[gnu::noinline]] void* operator new(std::size_t size, std::align_val_t alignment) {
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    std::size_t align = static_cast<std::size_t>(alignment);
+    std::size_t rounded = (size + align - 1) / align * align;
+    if (void* p = std::aligned_alloc(align, rounded ? rounded : align)) return p;
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void* p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+[[gnu::noinline]] void operator delete(void* p, std::size_t, std::align_val_t alignment) noexcept {
+    ::operator delete(p, alignment);
+}
+#else
+static const bool heapAllocationsCounted = false;
+#endif
+
+#endif
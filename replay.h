@@ -0,0 +1,250 @@
+// Batch replay shared by the Deque (1.cpp) and Stack (2.cpp) command-line
+// programs: './1 --batch <file|->' feeds a command trace through
+// runReplay, which parses it and reports throughput and latency.
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <charconv>
+#include <chrono>
+#include <exception>
+#include <stdexcept>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct CommandInfo {
+    const char* name;
+    bool takesValue;
+};
+
+// Whole command stream in memory: a read-only mapping for files, one
+// buffered read for stdin ("-").
+class InputBuffer {
+private:
+    const char* data;
+    std::size_t length;
+    bool mapped;
+    std::string owned;
+
+public:
+    explicit InputBuffer(const std::string& path) : data(nullptr), length(0), mapped(false) {
+        if (path == "-") {
+            char chunk[1 << 16];
+            std::size_t n;
+            while ((n = std::fread(chunk, 1, sizeof(chunk), stdin)) > 0) {
+                owned.append(chunk, n);
+            }
+            data = owned.data();
+            length = owned.size();
+            return;
+        }
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("cannot open " + path);
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("cannot stat " + path);
+        }
+        length = static_cast<std::size_t>(st.st_size);
+        if (length > 0) {
+            void* p = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("cannot map " + path);
+            }
+            ::madvise(p, length, MADV_SEQUENTIAL);
+            data = static_cast<const char*>(p);
+            mapped = true;
+        }
+        ::close(fd);
+    }
+
+    InputBuffer(const InputBuffer&) = delete;
+    InputBuffer& operator=(const InputBuffer&) = delete;
+
+    ~InputBuffer() {
+        if (mapped) ::munmap(const_cast<char*>(data), length);
+    }
+
+    const char* begin() const { return data; }
+    const char* end() const { return data + length; }
+};
+
+// Collects command output and writes it in large chunks.
+class OutputBuffer {
+private:
+    std::string buffer;
+
+public:
+    OutputBuffer() { buffer.reserve(1 << 16); }
+    ~OutputBuffer() { flush(); }
+
+    void append(const char* text) {
+        buffer += text;
+        if (buffer.size() >= (1 << 16)) flush();
+    }
+
+    void appendLine(const char* label, long long value) {
+        char digits[24];
+        char* last = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+        buffer += label;
+        buffer.append(digits, last);
+        buffer += '\n';
+        if (buffer.size() >= (1 << 16)) flush();
+    }
+
+    void flush() {
+        std::fwrite(buffer.data(), 1, buffer.size(), stdout);
+        buffer.clear();
+    }
+};
+
+// Log2-bucketed latency histogram: bucket k counts ops that took
+// [2^(k-1), 2^k) ns, bucket 0 those that took under 1 ns.
+struct LatencyHistogram {
+    static const int BUCKETS = 40;
+
+    long long buckets[BUCKETS] = {};
+    long long count = 0;
+
+    void record(long long ns) {
+        int bucket = 0;
+        while (ns > 0 && bucket < BUCKETS - 1) {
+            ns >>= 1;
+            ++bucket;
+        }
+        buckets[bucket]++;
+        count++;
+    }
+
+    long long percentileNs(double fraction) const {
+        long long seen = 0;
+        for (int i = 0; i < BUCKETS; ++i) {
+            seen += buckets[i];
+            if (seen >= fraction * count) return 1LL << i;
+        }
+        return 1LL << (BUCKETS - 1);
+    }
+};
+
+// Command words are dispatched through an open-addressing table keyed by a
+// cheap hash of the word, built once from the program's command list.
+class OpcodeTable {
+private:
+    static const int SIZE = 64;
+    const CommandInfo* commands;
+    signed char slots[SIZE];
+
+    static unsigned hash(const char* word, std::size_t n) {
+        return (static_cast<unsigned>(n) * 31u + static_cast<unsigned char>(word[0]) * 7u +
+                static_cast<unsigned char>(word[n / 2]) * 3u + static_cast<unsigned char>(word[n - 1])) & (SIZE - 1);
+    }
+
+public:
+    OpcodeTable(const CommandInfo* commands, int count) : commands(commands) {
+        std::memset(slots, -1, sizeof(slots));
+        for (int op = 0; op < count; ++op) {
+            const char* name = commands[op].name;
+            unsigned h = hash(name, std::strlen(name));
+            while (slots[h] != -1) h = (h + 1) & (SIZE - 1);
+            slots[h] = static_cast<signed char>(op);
+        }
+    }
+
+    int lookup(const char* word, std::size_t n) const {
+        for (unsigned h = hash(word, n); slots[h] != -1; h = (h + 1) & (SIZE - 1)) {
+            const char* name = commands[slots[h]].name;
+            if (std::strlen(name) == n && std::memcmp(name, word, n) == 0) return slots[h];
+        }
+        return -1;
+    }
+};
+
+inline bool isSpace(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+}
+
+// Replays a command file without prompts and reports throughput and
+// per-command latency on stderr. Query results still go to stdout.
+// commands is indexed by opcode; execute(op, value, out) runs one command
+// and may throw, which is reported as an error. exitOp stops the replay;
+// unknownCommand is the program's own line for an unrecognised word.
+template<typename Execute>
+int runReplay(const std::string& path, const CommandInfo* commands, int count, int exitOp,
+              const char* unknownCommand, Execute execute) {
+    InputBuffer input(path);
+    OpcodeTable table(commands, count);
+    OutputBuffer out;
+    std::vector<LatencyHistogram> histograms(count);
+    long long ops = 0, errors = 0;
+
+    using Clock = std::chrono::steady_clock;
+    const char* p = input.begin();
+    const char* end = input.end();
+    auto start = Clock::now();
+    while (true) {
+        while (p != end && isSpace(*p)) ++p;
+        if (p == end) break;
+        const char* word = p;
+        while (p != end && !isSpace(*p)) ++p;
+
+        int op = table.lookup(word, static_cast<std::size_t>(p - word));
+        if (op < 0) {
+            out.append(unknownCommand);
+            out.append("\n");
+            errors++;
+            continue;
+        }
+        if (op == exitOp) break;
+
+        int value = 0;
+        if (commands[op].takesValue) {
+            while (p != end && isSpace(*p)) ++p;
+            auto parsed = std::from_chars(p, end, value);
+            if (parsed.ec != std::errc()) {
+                out.append("Error: expected an integer\n");
+                errors++;
+                while (p != end && !isSpace(*p)) ++p;
+                continue;
+            }
+            p = parsed.ptr;
+        }
+
+        auto t0 = Clock::now();
+        try {
+            execute(op, value, out);
+        } catch (const std::exception& e) {
+            out.append("Error: ");
+            out.append(e.what());
+            out.append("\n");
+            errors++;
+        }
+        histograms[op].record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t0).count());
+        ops++;
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    out.flush();
+
+    std::fprintf(stderr, "%lld ops (%lld errors) in %.3f s: %.0f ops/s\n", ops, errors, seconds,
+                 seconds > 0 ? ops / seconds : 0.0);
+    for (int op = 0; op < count; ++op) {
+        const LatencyHistogram& h = histograms[op];
+        if (h.count == 0) continue;
+        std::fprintf(stderr, "%-14s %10lld ops  p50 < %lld ns  p99 < %lld ns\n", commands[op].name, h.count,
+                     h.percentileNs(0.50), h.percentileNs(0.99));
+        for (int i = 0; i < LatencyHistogram::BUCKETS; ++i) {
+            if (h.buckets[i] == 0) continue;
+            std::fprintf(stderr, "    < %10lld ns  %10lld  (%5.1f%%)\n", 1LL << i, h.buckets[i],
+                         100.0 * h.buckets[i] / h.count);
+        }
+    }
+    return 0;
+}
+
+#endif